@@ -9,6 +9,10 @@ pub struct Args {
     pub port: u16,
     #[clap(short, long, default_value_t = 8)]
     pub num_threads: usize,
+    /// Send file bodies with sendfile(2) instead of copying through tokio::fs.
+    /// Only has an effect on Linux.
+    #[clap(long)]
+    pub sendfile: bool,
 }
 
 impl Default for Args {
@@ -17,6 +21,7 @@ impl Default for Args {
             files: "www".to_string(),
             port: 8000,
             num_threads: 8,
+            sendfile: false,
         }
     }
 }
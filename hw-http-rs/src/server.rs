@@ -1,5 +1,6 @@
 use std::env;
 use std::net::{Ipv4Addr, SocketAddrV4};
+use std::sync::Arc;
 
 use crate::args;
 
@@ -7,6 +8,8 @@ use crate::http::*;
 use crate::stats::*;
 
 use clap::Parser;
+use tokio::fs;
+use tokio::io::{AsyncReadExt, AsyncWriteExt};
 use tokio::net::{TcpListener, TcpStream};
 
 use anyhow::Result;
@@ -30,6 +33,7 @@ pub fn main() -> Result<()> {
     log::info!("Port:\t\t{}", args.port);
     log::info!("Num threads:\t{}", args.num_threads);
     log::info!("Directory:\t\t{}", &args.files);
+    log::info!("Sendfile:\t\t{}", args.sendfile);
     log::info!("----------------------------------");
 
     // Initialize a thread pool that starts running `listen`
@@ -37,17 +41,165 @@ pub fn main() -> Result<()> {
         .enable_all()
         .worker_threads(args.num_threads)
         .build()?
-        .block_on(listen(args.port))
+        .block_on(listen(args.port, args.sendfile))
 }
 
-async fn listen(port: u16) -> Result<()> {
-    // Hint: you should call `handle_socket` in this function.
-    todo!("TODO: Part 2")
+async fn listen(port: u16, use_sendfile: bool) -> Result<()> {
+    let listener = TcpListener::bind(SocketAddrV4::new(Ipv4Addr::UNSPECIFIED, port)).await?;
+    let stats: StatsPtr = Arc::new(Stats::new());
+
+    loop {
+        let (socket, _) = listener.accept().await?;
+        let stats = stats.clone();
+        tokio::spawn(async move {
+            if let Err(e) = handle_socket(socket, &stats, use_sendfile).await {
+                log::warn!("Error handling connection: {}", e);
+            }
+        });
+    }
 }
 
 // Handles a single connection via `socket`.
-async fn handle_socket(mut socket: TcpStream) -> Result<()> {
-    todo!("TODO: Part 3")
+async fn handle_socket(mut socket: TcpStream, stats: &StatsPtr, use_sendfile: bool) -> Result<()> {
+    let request = match parse_request(&mut socket).await {
+        Ok(request) => request,
+        Err(_) => return send_status(&mut socket, stats, 400).await,
+    };
+    if request.path.contains("..") {
+        return send_status(&mut socket, stats, 403).await;
+    }
+
+    let path = format!(".{}", request.path);
+    let metadata = match fs::metadata(&path).await {
+        Ok(metadata) => metadata,
+        Err(_) => return send_status(&mut socket, stats, 404).await,
+    };
+
+    if metadata.is_dir() {
+        let index = format_index(&path);
+        match fs::metadata(&index).await {
+            Ok(m) if m.is_file() => {
+                serve_file(&mut socket, stats, &index, m.len(), use_sendfile).await
+            }
+            _ => serve_directory(&mut socket, stats, &path, request.path.trim_matches('/')).await,
+        }
+    } else {
+        serve_file(&mut socket, stats, &path, metadata.len(), use_sendfile).await
+    }
+}
+
+// Sends a response with no body.
+async fn send_status(socket: &mut TcpStream, stats: &StatsPtr, status_code: StatusCode) -> Result<()> {
+    start_response(socket, status_code).await?;
+    send_header(socket, "Content-Type", "text/html").await?;
+    end_headers(socket).await?;
+    incr(stats, status_code).await;
+    Ok(())
+}
+
+async fn serve_file(
+    socket: &mut TcpStream,
+    stats: &StatsPtr,
+    path: &str,
+    len: u64,
+    use_sendfile: bool,
+) -> Result<()> {
+    start_response(socket, 200).await?;
+    send_header(socket, "Content-Type", get_mime_type(path)).await?;
+    send_header(socket, "Content-Length", &len.to_string()).await?;
+    end_headers(socket).await?;
+    send_file_body(socket, path, len, use_sendfile).await?;
+    incr(stats, 200).await;
+    Ok(())
+}
+
+// Lists the entries of directory `path`, whose URL path is `/{url_path}`.
+async fn serve_directory(
+    socket: &mut TcpStream,
+    stats: &StatsPtr,
+    path: &str,
+    url_path: &str,
+) -> Result<()> {
+    start_response(socket, 200).await?;
+    send_header(socket, "Content-Type", get_mime_type("index.html")).await?;
+    end_headers(socket).await?;
+
+    let mut entries = fs::read_dir(path).await?;
+    while let Some(entry) = entries.next_entry().await? {
+        let name = entry.file_name().to_string_lossy().into_owned();
+        let href = if url_path.is_empty() {
+            name.clone()
+        } else {
+            format!("{}/{}", url_path, name)
+        };
+        socket.write_all(format_href(&href, &name).as_bytes()).await?;
+    }
+    incr(stats, 200).await;
+    Ok(())
+}
+
+/// Writes the first `len` bytes of the file at `path` to `socket`.
+///
+/// The portable path reads through `tokio::fs`, which bounces every chunk
+/// through the blocking pool and a user-space buffer. With `use_sendfile` on
+/// Linux the kernel copies straight from the page cache into the socket.
+pub(crate) async fn send_file_body(
+    socket: &mut TcpStream,
+    path: &str,
+    len: u64,
+    use_sendfile: bool,
+) -> Result<()> {
+    #[cfg(target_os = "linux")]
+    if use_sendfile {
+        let file = fs::File::open(path).await?.into_std().await;
+        return sendfile_body(socket, &file, len).await;
+    }
+    #[cfg(not(target_os = "linux"))]
+    let _ = use_sendfile;
+
+    let file = fs::File::open(path).await?;
+    tokio::io::copy(&mut file.take(len), socket).await?;
+    Ok(())
+}
+
+/// Largest chunk handed to one sendfile(2) call, so that a big file does not
+/// hold a worker thread for too long.
+#[cfg(target_os = "linux")]
+const SENDFILE_CHUNK: u64 = 1 << 20;
+
+// Drives sendfile(2) from tokio's readiness events instead of a blocking
+// thread: wait until the socket is writable, send as much as the kernel
+// accepts, and go back to waiting on EAGAIN.
+#[cfg(target_os = "linux")]
+async fn sendfile_body(socket: &TcpStream, file: &std::fs::File, len: u64) -> Result<()> {
+    use std::io;
+    use std::os::unix::io::AsRawFd;
+    use tokio::io::Interest;
+
+    let mut offset: libc::off_t = 0;
+    while (offset as u64) < len {
+        socket.writable().await?;
+        let count = (len - offset as u64).min(SENDFILE_CHUNK) as usize;
+        let sent = socket.try_io(Interest::WRITABLE, || {
+            // SAFETY: both descriptors stay open for the duration of the call
+            // and `offset` is a valid, exclusively borrowed off_t.
+            let n = unsafe {
+                libc::sendfile(socket.as_raw_fd(), file.as_raw_fd(), &mut offset, count)
+            };
+            if n < 0 {
+                Err(io::Error::last_os_error())
+            } else {
+                Ok(n as usize)
+            }
+        });
+        match sent {
+            Ok(0) => return Err(io::Error::from(io::ErrorKind::UnexpectedEof).into()),
+            Ok(_) => {}
+            Err(e) if e.kind() == io::ErrorKind::WouldBlock => {}
+            Err(e) => return Err(e.into()),
+        }
+    }
+    Ok(())
 }
 
 // You are free (and encouraged) to add other funtions to this file.
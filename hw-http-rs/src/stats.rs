@@ -1,38 +1,128 @@
-use std::{collections::HashMap, sync::Arc};
-
-use tokio::sync::RwLock;
+use std::{
+    collections::HashMap,
+    fmt,
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        Arc, Mutex,
+    },
+};
 
 use crate::http::StatusCode;
 
-#[derive(Debug, Default, Eq, PartialEq, Clone)]
+/// Status codes in `MIN_STATUS..=MAX_STATUS` get a dedicated counter slot.
+/// Anything outside that range is rare and falls back to a locked map.
+const MIN_STATUS: StatusCode = 100;
+const MAX_STATUS: StatusCode = 599;
+const NUM_SLOTS: usize = (MAX_STATUS - MIN_STATUS + 1) as usize;
+
+/// Number of counter shards. Each thread sticks to one shard, so with at most
+/// `NUM_SHARDS` workers no two threads ever write the same cache line.
+const NUM_SHARDS: usize = 16;
+
+/// One full set of counters, aligned so that neighbouring shards never share
+/// a cache line.
+#[repr(align(64))]
+struct Shard {
+    counts: [AtomicUsize; NUM_SLOTS],
+}
+
+impl Shard {
+    fn new() -> Self {
+        Shard {
+            counts: std::array::from_fn(|_| AtomicUsize::new(0)),
+        }
+    }
+}
+
+static NEXT_SHARD: AtomicUsize = AtomicUsize::new(0);
+
+thread_local! {
+    /// Shard used by the current thread, handed out round-robin.
+    static SHARD: usize = NEXT_SHARD.fetch_add(1, Ordering::Relaxed) % NUM_SHARDS;
+}
+
+/// Per-status response counters.
+///
+/// `incr` is a single relaxed atomic add on a shard owned by the calling
+/// worker, so it never blocks. `items` sums the shards and is meant for the
+/// (rare) reader that reports the statistics.
 pub struct Stats {
-    statuses: HashMap<StatusCode, usize>,
+    shards: Box<[Shard]>,
+    other: Mutex<HashMap<StatusCode, usize>>,
 }
 
-pub type StatsPtr = Arc<RwLock<Stats>>;
+pub type StatsPtr = Arc<Stats>;
 
 impl Stats {
     pub fn new() -> Self {
         Stats {
-            statuses: HashMap::new(),
+            shards: (0..NUM_SHARDS).map(|_| Shard::new()).collect(),
+            other: Mutex::new(HashMap::new()),
         }
     }
 
-    pub fn incr(&mut self, s: StatusCode) {
-        todo!("TODO: Part 4");
+    pub fn incr(&self, s: StatusCode) {
+        if !(MIN_STATUS..=MAX_STATUS).contains(&s) {
+            *self.other.lock().unwrap().entry(s).or_insert(0) += 1;
+            return;
+        }
+        let shard = SHARD.with(|&i| i);
+        self.shards[shard].counts[(s - MIN_STATUS) as usize].fetch_add(1, Ordering::Relaxed);
     }
 
     pub fn items(&self) -> Vec<(StatusCode, usize)> {
-        let mut items = self
-            .statuses
-            .iter()
-            .map(|(&k, &v)| (k, v))
+        let mut items = (0..NUM_SLOTS)
+            .filter_map(|slot| {
+                let count = self
+                    .shards
+                    .iter()
+                    .map(|shard| shard.counts[slot].load(Ordering::Relaxed))
+                    .sum::<usize>();
+                (count > 0).then(|| (MIN_STATUS + slot as StatusCode, count))
+            })
             .collect::<Vec<_>>();
+        items.extend(self.other.lock().unwrap().iter().map(|(&k, &v)| (k, v)));
         items.sort_by_key(|&(k, _)| k);
         items
     }
 }
 
+impl Default for Stats {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl Clone for Stats {
+    fn clone(&self) -> Self {
+        let s = Stats::new();
+        for (k, v) in self.items() {
+            if (MIN_STATUS..=MAX_STATUS).contains(&k) {
+                s.shards[0].counts[(k - MIN_STATUS) as usize].store(v, Ordering::Relaxed);
+            } else {
+                s.other.lock().unwrap().insert(k, v);
+            }
+        }
+        s
+    }
+}
+
+impl PartialEq for Stats {
+    fn eq(&self, other: &Self) -> bool {
+        self.items() == other.items()
+    }
+}
+
+impl Eq for Stats {}
+
+impl fmt::Debug for Stats {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("Stats")
+            .field("statuses", &self.items())
+            .finish()
+    }
+}
+
 pub async fn incr(s: &StatsPtr, sc: StatusCode) {
-    todo!("TODO: Part 4");
+    s.incr(sc);
 }
@@ -1,3 +1,4 @@
 mod args;
 mod http;
+mod server;
 mod stats;
@@ -0,0 +1,76 @@
+use std::path::PathBuf;
+use std::time::Instant;
+
+use anyhow::Result;
+use tokio::io::AsyncReadExt;
+use tokio::net::{TcpListener, TcpStream};
+
+use crate::server::send_file_body;
+
+// Writes `len` bytes of a repeating pattern to a fresh file in the temp dir.
+fn make_file(name: &str, len: usize) -> Result<PathBuf> {
+    let path = std::env::temp_dir().join(format!("http_server_rs_{}_{}", std::process::id(), name));
+    let data = (0..len).map(|i| (i % 251) as u8).collect::<Vec<_>>();
+    std::fs::write(&path, data)?;
+    Ok(path)
+}
+
+// Sends `len` bytes of `path` over a loopback connection and returns what the
+// other end received.
+async fn transfer(path: &str, len: u64, use_sendfile: bool) -> Result<Vec<u8>> {
+    let listener = TcpListener::bind("127.0.0.1:0").await?;
+    let addr = listener.local_addr()?;
+    let reader = tokio::spawn(async move {
+        let mut stream = TcpStream::connect(addr).await?;
+        let mut buf = Vec::new();
+        stream.read_to_end(&mut buf).await?;
+        Ok::<_, anyhow::Error>(buf)
+    });
+
+    let (mut socket, _) = listener.accept().await?;
+    send_file_body(&mut socket, path, len, use_sendfile).await?;
+    drop(socket);
+    reader.await?
+}
+
+#[tokio::test(flavor = "multi_thread", worker_threads = 2)]
+async fn send_file_body_paths_agree() -> Result<()> {
+    let len = 3 * 1024 * 1024 + 17;
+    let path = make_file("agree", len)?;
+    let path = path.to_str().unwrap();
+
+    let copied = transfer(path, len as u64, false).await?;
+    let sent = transfer(path, len as u64, true).await?;
+    assert_eq!(copied.len(), len);
+    assert!(copied == sent);
+
+    std::fs::remove_file(path)?;
+    Ok(())
+}
+
+#[tokio::test(flavor = "multi_thread", worker_threads = 2)]
+#[ignore]
+/// Throughput of the tokio::fs path versus sendfile. Run with
+/// `cargo test --release -- --ignored --nocapture bench_send_file_body`.
+async fn bench_send_file_body() -> Result<()> {
+    const LEN: usize = 64 * 1024 * 1024;
+    const ROUNDS: usize = 8;
+    let path = make_file("bench", LEN)?;
+    let path = path.to_str().unwrap();
+
+    for (name, use_sendfile) in [("tokio::fs", false), ("sendfile", true)] {
+        let start = Instant::now();
+        for _ in 0..ROUNDS {
+            assert_eq!(transfer(path, LEN as u64, use_sendfile).await?.len(), LEN);
+        }
+        let elapsed = start.elapsed();
+        println!(
+            "{:>10}: {:>8.1} MB/s",
+            name,
+            (LEN * ROUNDS) as f64 / elapsed.as_secs_f64() / 1e6
+        );
+    }
+
+    std::fs::remove_file(path)?;
+    Ok(())
+}
@@ -1,7 +1,7 @@
 use std::sync::Arc;
+use std::time::Instant;
 
-use tokio::sync::RwLock;
-
+use crate::http::StatusCode;
 use crate::stats::*;
 
 #[test]
@@ -28,7 +28,7 @@ fn incr_items() {
         (502, 14),
     ];
 
-    let mut s = Stats::new();
+    let s = Stats::new();
 
     for (code, count) in counts {
         for _ in 0..count {
@@ -50,7 +50,7 @@ fn incr_items_four() {
         (293232, 4 * 93),
     ];
 
-    let mut s = Stats::new();
+    let s = Stats::new();
 
     for _ in 0..4 {
         for (code, count) in counts {
@@ -77,7 +77,7 @@ fn items_sorted() {
     let mut sorted = Vec::from(counts);
     sorted.sort_by_key(|v| v.0);
 
-    let mut s = Stats::new();
+    let s = Stats::new();
 
     for (code, count) in counts {
         for _ in 0..count {
@@ -90,7 +90,7 @@ fn items_sorted() {
 
 #[test]
 fn stats_ptr_new() {
-    let _: StatsPtr = Arc::new(RwLock::new(Stats::new()));
+    let _: StatsPtr = Arc::new(Stats::new());
 }
 
 #[tokio::test]
@@ -104,7 +104,7 @@ async fn incr_stats_ptr() {
         (293232, 4 * 65),
     ];
 
-    let s: StatsPtr = Arc::new(RwLock::new(Stats::new()));
+    let s: StatsPtr = Arc::new(Stats::new());
 
     for _ in 0..4 {
         for (code, count) in counts {
@@ -114,5 +114,81 @@ async fn incr_stats_ptr() {
         }
     }
 
-    assert_eq!(s.read().await.items(), counts);
+    assert_eq!(s.items(), counts);
+}
+
+#[test]
+/// Counts from many threads land in different shards but sum correctly.
+fn incr_many_threads() {
+    let s: StatsPtr = Arc::new(Stats::new());
+
+    let threads = (0..32)
+        .map(|_| {
+            let s = s.clone();
+            std::thread::spawn(move || {
+                for _ in 0..1000 {
+                    s.incr(200);
+                    s.incr(404);
+                    s.incr(7);
+                }
+            })
+        })
+        .collect::<Vec<_>>();
+    for t in threads {
+        t.join().unwrap();
+    }
+
+    assert_eq!(s.items(), [(7, 32000), (200, 32000), (404, 32000)]);
+}
+
+#[test]
+fn clone_eq() {
+    let s = Stats::new();
+    s.incr(200);
+    s.incr(200);
+    s.incr(1000);
+    assert_eq!(s.clone(), s);
+    assert_eq!(s.clone().items(), [(200, 2), (1000, 1)]);
+}
+
+#[test]
+#[ignore]
+/// Throughput of `incr` as the number of tokio workers grows. Run with
+/// `cargo test --release -- --ignored --nocapture bench_incr_scaling`.
+fn bench_incr_scaling() {
+    const PER_WORKER: usize = 1 << 22;
+
+    for workers in [1, 2, 4, 8, 16] {
+        let rt = tokio::runtime::Builder::new_multi_thread()
+            .worker_threads(workers)
+            .build()
+            .unwrap();
+        let s: StatsPtr = Arc::new(Stats::new());
+
+        let start = Instant::now();
+        rt.block_on(async {
+            let tasks = (0..workers)
+                .map(|_| {
+                    let s = s.clone();
+                    tokio::spawn(async move {
+                        for i in 0..PER_WORKER {
+                            incr(&s, 200 + (i % 4) as StatusCode).await;
+                        }
+                    })
+                })
+                .collect::<Vec<_>>();
+            for t in tasks {
+                t.await.unwrap();
+            }
+        });
+        let elapsed = start.elapsed();
+
+        let total = workers * PER_WORKER;
+        assert_eq!(s.items().iter().map(|&(_, v)| v).sum::<usize>(), total);
+        println!(
+            "{:>2} workers: {:>8.1} M incr/s",
+            workers,
+            total as f64 / elapsed.as_secs_f64() / 1e6
+        );
+    }
 }
@@ -0,0 +1,241 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "accesslog.h"
+
+/* Records per thread ring. Must be a power of two. */
+#define ACCESS_LOG_RING_SIZE 1024
+
+/* Size of the formatted output buffer handed to each write(). */
+#define ACCESS_LOG_BUFFER_SIZE 65536
+
+/* How long the writer sleeps between passes over the rings. */
+#define ACCESS_LOG_INTERVAL_NS 100000000L
+
+/* Longest formatted record, with room to spare. */
+#define ACCESS_LOG_LINE_MAX 256
+
+/* Longer methods and paths are cut short in the log. */
+#define ACCESS_LOG_METHOD_SIZE 8
+#define ACCESS_LOG_PATH_SIZE 96
+
+typedef struct access_log_record {
+  struct timespec time; // When the response was done.
+  unsigned long micros; // Time taken to respond.
+  size_t bytes;
+  struct in_addr address;
+  in_port_t port;
+  short status;
+  char method[ACCESS_LOG_METHOD_SIZE];
+  char path[ACCESS_LOG_PATH_SIZE];
+} access_log_record_t;
+
+/*
+ * Single-producer single-consumer ring. Only the owning thread advances
+ * `head` and only the writer advances `tail`, so neither side needs a lock.
+ */
+typedef struct access_log_ring {
+  access_log_record_t records[ACCESS_LOG_RING_SIZE];
+  unsigned long head;
+  unsigned long tail;
+  unsigned long seen;     // Calls on the owning thread, for sampling.
+  unsigned long dropped;  // Records lost because the ring was full.
+  unsigned long reported; // Value of `dropped` last written to the log.
+  int closed;             // Set when the owning thread exits.
+  struct access_log_ring* next;
+} access_log_ring_t;
+
+static int log_fd = -1;
+static int log_sample = 1;
+
+/* All live rings. The mutex also serializes draining. */
+static access_log_ring_t* rings;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread access_log_ring_t* thread_ring;
+static pthread_key_t ring_key;
+
+/* Marks the ring of an exiting thread so the writer frees it once drained. */
+static void close_ring(void* ring) {
+  __atomic_store_n(&((access_log_ring_t*)ring)->closed, 1, __ATOMIC_RELEASE);
+}
+
+static access_log_ring_t* get_ring(void) {
+  if (thread_ring != NULL)
+    return thread_ring;
+
+  access_log_ring_t* ring = calloc(1, sizeof(access_log_ring_t));
+  if (ring == NULL)
+    return NULL;
+  pthread_setspecific(ring_key, ring);
+
+  pthread_mutex_lock(&rings_mutex);
+  ring->next = rings;
+  rings = ring;
+  pthread_mutex_unlock(&rings_mutex);
+
+  thread_ring = ring;
+  return ring;
+}
+
+/* Copies SOURCE into DEST of SIZE bytes, truncating it, or "-" if NULL. */
+static void copy_field(char* dest, char* source, size_t size) {
+  if (source == NULL)
+    source = "-";
+  size_t length = strnlen(source, size - 1);
+  memcpy(dest, source, length);
+  dest[length] = '\0';
+}
+
+void access_log_request(struct sockaddr_in* peer, char* method, char* path, int status,
+                        size_t bytes, struct timespec* started) {
+  if (log_fd < 0)
+    return;
+
+  access_log_ring_t* ring = get_ring();
+  if (ring == NULL || ring->seen++ % log_sample != 0)
+    return;
+
+  unsigned long head = ring->head;
+  if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ACCESS_LOG_RING_SIZE) {
+    __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  access_log_record_t* record = &ring->records[head & (ACCESS_LOG_RING_SIZE - 1)];
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  record->micros =
+      (now.tv_sec - started->tv_sec) * 1000000 + (now.tv_nsec - started->tv_nsec) / 1000;
+  clock_gettime(CLOCK_REALTIME_COARSE, &record->time);
+
+  if (peer != NULL && peer->sin_family == AF_INET) {
+    record->address = peer->sin_addr;
+    record->port = peer->sin_port;
+  } else {
+    record->address.s_addr = 0;
+    record->port = 0;
+  }
+
+  record->status = status;
+  record->bytes = bytes;
+  copy_field(record->method, method, sizeof(record->method));
+  copy_field(record->path, path, sizeof(record->path));
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void write_all(char* buffer, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(log_fd, buffer, length);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    buffer += written;
+    length -= written;
+  }
+}
+
+static size_t format_record(char* line, access_log_record_t* record) {
+  char address[INET_ADDRSTRLEN];
+  char date[32];
+  struct tm tm;
+
+  inet_ntop(AF_INET, &record->address, address, sizeof(address));
+  gmtime_r(&record->time.tv_sec, &tm);
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+  return snprintf(line, ACCESS_LOG_LINE_MAX, "%s.%03ldZ %s:%d \"%s %s\" %d %zu %luus\n", date,
+                  record->time.tv_nsec / 1000000, address, ntohs(record->port), record->method,
+                  record->path, record->status, record->bytes, record->micros);
+}
+
+/*
+ * Moves every pending record into large writes and frees rings whose
+ * threads have exited. Caller must hold rings_mutex.
+ */
+static void drain_rings(void) {
+  static char buffer[ACCESS_LOG_BUFFER_SIZE];
+  size_t length = 0;
+
+  access_log_ring_t** link = &rings;
+  while (*link != NULL) {
+    access_log_ring_t* ring = *link;
+    int closed = __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE);
+    unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    unsigned long tail = ring->tail;
+
+    for (; tail != head; tail++) {
+      if (length + ACCESS_LOG_LINE_MAX > sizeof(buffer)) {
+        write_all(buffer, length);
+        length = 0;
+      }
+      length += format_record(buffer + length, &ring->records[tail & (ACCESS_LOG_RING_SIZE - 1)]);
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+    unsigned long dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    if (dropped != ring->reported) {
+      if (length + ACCESS_LOG_LINE_MAX > sizeof(buffer)) {
+        write_all(buffer, length);
+        length = 0;
+      }
+      length += snprintf(buffer + length, ACCESS_LOG_LINE_MAX,
+                         "Access log ring full, dropped %lu records\n", dropped - ring->reported);
+      ring->reported = dropped;
+    }
+
+    if (closed) {
+      *link = ring->next;
+      free(ring);
+    } else {
+      link = &ring->next;
+    }
+  }
+
+  write_all(buffer, length);
+}
+
+static void* access_log_writer(void* unused) {
+  (void)unused;
+  struct timespec interval = {0, ACCESS_LOG_INTERVAL_NS};
+
+  while (1) {
+    nanosleep(&interval, NULL);
+    access_log_flush();
+  }
+  return NULL;
+}
+
+void access_log_flush(void) {
+  if (log_fd < 0)
+    return;
+  pthread_mutex_lock(&rings_mutex);
+  drain_rings();
+  pthread_mutex_unlock(&rings_mutex);
+}
+
+int access_log_init(char* path, int sample) {
+  int fd = STDOUT_FILENO;
+  if (path != NULL) {
+    fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+      return -1;
+  }
+
+  pthread_key_create(&ring_key, close_ring);
+  log_sample = sample > 0 ? sample : 1;
+  log_fd = fd;
+
+  pthread_t writer;
+  pthread_create(&writer, NULL, access_log_writer, NULL);
+  pthread_detach(writer);
+  return 0;
+}
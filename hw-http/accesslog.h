@@ -0,0 +1,40 @@
+#ifndef __ACCESSLOG__
+#define __ACCESSLOG__
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <time.h>
+
+/*
+ * Access log with a cheap hot path.
+ *
+ * Every thread that logs gets its own fixed-size ring of binary records, so
+ * access_log_request() never takes a lock or touches stdio: it copies one
+ * record into the ring and returns. A background thread drains all rings,
+ * formats the records and hands them to the log file in large write()s.
+ * If a ring fills up faster than it is drained, new records are dropped and
+ * counted rather than blocking the caller.
+ */
+
+/*
+ * Starts the background writer. Records go to the file at PATH (appended to),
+ * or to stdout if PATH is NULL. Only one in every SAMPLE calls to
+ * access_log_request() on each thread is recorded. Returns 0 on success
+ * and -1 if PATH cannot be opened.
+ */
+int access_log_init(char* path, int sample);
+
+/*
+ * Records a response with STATUS and BYTES of body, sent to the client at
+ * PEER, as accept() returned it, or NULL if unknown, for METHOD and PATH,
+ * which are NULL if the request could not be parsed. Call it after the
+ * response is sent. STARTED is when the request was taken up, from
+ * CLOCK_MONOTONIC, for the time the response took.
+ */
+void access_log_request(struct sockaddr_in* peer, char* method, char* path, int status,
+                        size_t bytes, struct timespec* started);
+
+/* Writes out everything logged so far. Safe to call from any thread. */
+void access_log_flush(void);
+
+#endif
@@ -0,0 +1,158 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "filecache.h"
+#include "utlist.h"
+
+#define FILECACHE_BUCKETS 4096
+
+static filecache_entry_t* buckets[FILECACHE_BUCKETS];
+static filecache_entry_t* lru;
+static size_t cache_capacity;
+static size_t cache_max_file_size;
+static size_t cache_size;
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void filecache_init(size_t capacity, size_t max_file_size) {
+  cache_capacity = capacity;
+  cache_max_file_size = max_file_size < capacity ? max_file_size : capacity;
+}
+
+/* FNV-1a over the key, which is "host\0path\0". */
+static uint32_t hash_key(char* key, size_t length) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++)
+    hash = (hash ^ (unsigned char)key[i]) * 16777619u;
+  return hash;
+}
+
+static void free_entry(filecache_entry_t* entry) {
+  free(entry->key);
+  free(entry->data);
+  free(entry);
+}
+
+/* Unlinks ENTRY from the table and LRU list. Caller holds cache_mutex. */
+static void remove_entry(filecache_entry_t* entry) {
+  filecache_entry_t** link = &buckets[entry->hash % FILECACHE_BUCKETS];
+  while (*link != entry)
+    link = &(*link)->hash_next;
+  *link = entry->hash_next;
+  DL_DELETE(lru, entry);
+
+  cache_size -= entry->size;
+  entry->evicted = 1;
+  if (entry->refcount == 0)
+    free_entry(entry);
+}
+
+static char* read_file(char* path, size_t size) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  char* data = malloc(size ? size : 1);
+  size_t offset = 0;
+  while (data != NULL && offset < size) {
+    ssize_t bytes_read = read(fd, data + offset, size - offset);
+    if (bytes_read <= 0) {
+      free(data);
+      data = NULL;
+      break;
+    }
+    offset += bytes_read;
+  }
+  close(fd);
+  return data;
+}
+
+/* Returns the entry for KEY, or NULL. Caller holds cache_mutex. */
+static filecache_entry_t* lookup(char* key, size_t key_length, uint32_t hash) {
+  filecache_entry_t* entry;
+  for (entry = buckets[hash % FILECACHE_BUCKETS]; entry != NULL; entry = entry->hash_next) {
+    if (entry->key_length == key_length && memcmp(entry->key, key, key_length) == 0)
+      break;
+  }
+  return entry;
+}
+
+static int same_version(filecache_entry_t* entry, struct stat* file_stat) {
+  return entry->size == (size_t)file_stat->st_size &&
+         entry->mtime.tv_sec == file_stat->st_mtim.tv_sec &&
+         entry->mtime.tv_nsec == file_stat->st_mtim.tv_nsec;
+}
+
+filecache_entry_t* filecache_get(char* host, char* path, struct stat* file_stat) {
+  if (cache_capacity == 0 || (size_t)file_stat->st_size > cache_max_file_size)
+    return NULL;
+
+  size_t host_length = strlen(host) + 1;
+  size_t key_length = host_length + strlen(path) + 1;
+  char* key = malloc(key_length);
+  if (key == NULL)
+    return NULL;
+  memcpy(key, host, host_length);
+  memcpy(key + host_length, path, key_length - host_length);
+  uint32_t hash = hash_key(key, key_length);
+
+  pthread_mutex_lock(&cache_mutex);
+  filecache_entry_t* entry = lookup(key, key_length, hash);
+  if (entry != NULL && same_version(entry, file_stat)) {
+    entry->refcount++;
+    DL_DELETE(lru, entry);
+    DL_PREPEND(lru, entry);
+    pthread_mutex_unlock(&cache_mutex);
+    free(key);
+    return entry;
+  }
+  if (entry != NULL)
+    remove_entry(entry);
+  pthread_mutex_unlock(&cache_mutex);
+
+  /* Read the file without holding the lock. */
+  entry = calloc(1, sizeof(filecache_entry_t));
+  char* data = read_file(path, file_stat->st_size);
+  if (entry == NULL || data == NULL) {
+    free(entry);
+    free(data);
+    free(key);
+    return NULL;
+  }
+  entry->key = key;
+  entry->key_length = key_length;
+  entry->hash = hash;
+  entry->data = data;
+  entry->size = file_stat->st_size;
+  entry->mtime = file_stat->st_mtim;
+  entry->refcount = 1;
+
+  pthread_mutex_lock(&cache_mutex);
+  /* Another thread may have loaded the same file meanwhile; ours is as new. */
+  filecache_entry_t* other = lookup(key, key_length, hash);
+  if (other != NULL)
+    remove_entry(other);
+
+  /* utlist keeps the tail of the list at lru->prev. */
+  while (cache_size + entry->size > cache_capacity && lru != NULL)
+    remove_entry(lru->prev);
+
+  entry->hash_next = buckets[hash % FILECACHE_BUCKETS];
+  buckets[hash % FILECACHE_BUCKETS] = entry;
+  DL_PREPEND(lru, entry);
+  cache_size += entry->size;
+  pthread_mutex_unlock(&cache_mutex);
+
+  return entry;
+}
+
+void filecache_release(filecache_entry_t* entry) {
+  pthread_mutex_lock(&cache_mutex);
+  int unused = --entry->refcount == 0 && entry->evicted;
+  pthread_mutex_unlock(&cache_mutex);
+  if (unused)
+    free_entry(entry);
+}
@@ -0,0 +1,45 @@
+#ifndef __FILECACHE__
+#define __FILECACHE__
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/*
+ * In-memory cache of small static files, shared by every worker thread and
+ * every virtual host. Entries are keyed by (host, path) and checked against
+ * the file's size and modification time on each lookup, so edits on disk are
+ * picked up immediately. When the cache is over capacity, the least recently
+ * used entries are evicted.
+ */
+
+typedef struct filecache_entry {
+  char* key;
+  size_t key_length;
+  unsigned int hash;
+  char* data;
+  size_t size;
+  struct timespec mtime;
+  int refcount;
+  int evicted;                         // No longer reachable from the cache.
+  struct filecache_entry* hash_next;   // Bucket chain.
+  struct filecache_entry *prev, *next; // LRU list, most recent first.
+} filecache_entry_t;
+
+/*
+ * Sets up the cache to hold at most CAPACITY bytes of file data, caching only
+ * files of at most MAX_FILE_SIZE bytes. A CAPACITY of 0 disables caching.
+ */
+void filecache_init(size_t capacity, size_t max_file_size);
+
+/*
+ * Returns the cached contents of PATH on HOST, whose current metadata is
+ * FILE_STAT, reading the file into the cache if needed. Returns NULL if the
+ * file should not (or could not) be cached; the caller then serves it from
+ * disk. A returned entry stays valid until passed to filecache_release().
+ */
+filecache_entry_t* filecache_get(char* host, char* path, struct stat* file_stat);
+
+void filecache_release(filecache_entry_t* entry);
+
+#endif
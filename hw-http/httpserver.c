@@ -9,14 +9,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 #include <unistd.h>
 
+#include "accesslog.h"
+#include "filecache.h"
 #include "libhttp.h"
 #include "wq.h"
+#ifdef HTTPS
+#include "tls.h"
+#endif
 
 /*
  * Global configuration variables.
@@ -30,25 +37,97 @@ int server_port; // Default value: 8000
 char* server_files_directory;
 char* server_proxy_hostname;
 int server_proxy_port;
+char* access_log_path;      // Default value: NULL (log to stdout)
+int access_log_sample = 1; // Log one in this many connections per thread
+char* tls_cert_path;        // Serve HTTPS when both of these are set
+char* tls_key_path;
+size_t file_cache_size = 64 << 20; // Bytes of small files kept in memory
+
+/* Peer address of each connection, as accept() returned it, for the access log. */
+static struct sockaddr_in client_addresses[HTTP_MAX_FDS];
+
+/* Files larger than this are always sent from disk. */
+#define FILE_CACHE_MAX_FILE_SIZE (1 << 20)
+
+/*
+ * Virtual hosts. A request whose Host header matches `name` is served from
+ * `root` (an absolute path); anything else is served from
+ * server_files_directory, if given.
+ */
+struct vhost {
+  char* name;
+  char* root;
+};
+
+#define MAX_VHOSTS 256
+struct vhost vhosts[MAX_VHOSTS];
+int num_vhosts;
+
+/* Returns the virtual host for HOST (which may include a port), or NULL. */
+struct vhost* find_vhost(char* host) {
+  if (host == NULL)
+    return NULL;
+  char* colon = strchr(host, ':');
+  size_t length = colon ? (size_t)(colon - host) : strlen(host);
+  for (int i = 0; i < num_vhosts; i++) {
+    if (strlen(vhosts[i].name) == length && strncasecmp(vhosts[i].name, host, length) == 0)
+      return &vhosts[i];
+  }
+  return NULL;
+}
 
 /*
  * Serves the contents the file stored at `path` to the client socket `fd`.
+ * Small files come from the file cache, keyed by `host` and `path`.
  * It is the caller's reponsibility to ensure that the file stored at `path` exists.
+ * Returns the response status, and sets `*bytes` to the size of the body.
  */
-void serve_file(int fd, char* path) {
+int serve_file(int fd, char* host, char* path, size_t* bytes) {
 
   /* TODO: PART 2 */
   /* PART 2 BEGIN */
 
+  struct stat file_stat;
+  filecache_entry_t* entry = NULL;
+  if (stat(path, &file_stat) == 0)
+    entry = filecache_get(host, path, &file_stat);
+
+  int file_fd = -1;
+  if (entry == NULL && ((file_fd = open(path, O_RDONLY)) < 0 || fstat(file_fd, &file_stat) < 0)) {
+    if (file_fd >= 0)
+      close(file_fd);
+    http_start_response(fd, 404);
+    http_send_header(fd, "Content-Type", "text/html");
+    http_end_headers(fd);
+    return 404;
+  }
+
+  size_t size = entry ? entry->size : (size_t)file_stat.st_size;
+  char content_length[24];
+  snprintf(content_length, sizeof(content_length), "%zu", size);
+
   http_start_response(fd, 200);
   http_send_header(fd, "Content-Type", http_get_mime_type(path));
-  http_send_header(fd, "Content-Length", "0"); // TODO: change this line too
+  http_send_header(fd, "Content-Length", content_length);
   http_end_headers(fd);
+  if (entry != NULL) {
+    http_send_data(fd, entry->data, entry->size);
+    filecache_release(entry);
+  } else {
+    http_send_file(fd, file_fd, size);
+    close(file_fd);
+  }
+  *bytes = size;
+  return 200;
 
   /* PART 2 END */
 }
 
-void serve_directory(int fd, char* path) {
+/*
+ * Lists the directory stored at `path`, which was requested as `url_path`.
+ * Returns the size of the body sent.
+ */
+size_t serve_directory(int fd, char* path, char* url_path) {
   http_start_response(fd, 200);
   http_send_header(fd, "Content-Type", http_get_mime_type(".html"));
   http_end_headers(fd);
@@ -56,17 +135,56 @@ void serve_directory(int fd, char* path) {
   /* TODO: PART 3 */
   /* PART 3 BEGIN */
 
-  // TODO: Open the directory (Hint: opendir() may be useful here)
+  size_t bytes = 0;
+  DIR* directory = opendir(path);
+  if (directory == NULL)
+    return bytes;
+
+  /* Links are relative to the site root: drop any surrounding slashes from
+   * the URL path, and use "." for the root itself. */
+  char* link_start = url_path;
+  while (*link_start == '/')
+    link_start++;
+  char* link_path = strdup(link_start);
+  size_t link_length = strlen(link_path);
+  while (link_length > 0 && link_path[link_length - 1] == '/')
+    link_path[--link_length] = '\0';
+  if (link_length == 0) {
+    free(link_path);
+    link_path = strdup(".");
+  }
 
-  /**
-   * TODO: For each entry in the directory (Hint: look at the usage of readdir() ),
-   * send a string containing a properly formatted HTML. (Hint: the http_format_href()
-   * function in libhttp.c may be useful here)
-   */
+  struct dirent* entry;
+  while ((entry = readdir(directory)) != NULL) {
+    char* buffer = malloc(strlen("<a href=\"//\"></a><br/>") + strlen(link_path) +
+                          strlen(entry->d_name) * 2 + 1);
+    if (buffer == NULL)
+      break;
+    http_format_href(buffer, link_path, entry->d_name);
+    http_send_string(fd, buffer);
+    bytes += strlen(buffer);
+    free(buffer);
+  }
+  free(link_path);
+  closedir(directory);
+  return bytes;
 
   /* PART 3 END */
 }
 
+/*
+ * Logs the response to `request` (NULL if it could not be parsed), which
+ * was read at `started`, closes the client socket `fd` and frees `request`.
+ */
+void finish_request(int fd, struct http_request* request, int status, size_t bytes,
+                    struct timespec* started) {
+  access_log_request(fd >= 0 && fd < HTTP_MAX_FDS ? &client_addresses[fd] : NULL,
+                     request ? request->method : NULL, request ? request->path : NULL, status,
+                     bytes, started);
+  http_close(fd);
+  http_request_free(request);
+}
+
 /*
  * Reads an HTTP request from client socket (fd), and writes an HTTP response
  * containing:
@@ -82,13 +200,15 @@ void serve_directory(int fd, char* path) {
  */
 void handle_files_request(int fd) {
 
+  struct timespec started;
+  clock_gettime(CLOCK_MONOTONIC, &started);
   struct http_request* request = http_request_parse(fd);
 
   if (request == NULL || request->path[0] != '/') {
     http_start_response(fd, 400);
     http_send_header(fd, "Content-Type", "text/html");
     http_end_headers(fd);
-    close(fd);
+    finish_request(fd, request, 400, 0, &started);
     return;
   }
 
@@ -96,15 +216,26 @@ void handle_files_request(int fd) {
     http_start_response(fd, 403);
     http_send_header(fd, "Content-Type", "text/html");
     http_end_headers(fd);
-    close(fd);
+    finish_request(fd, request, 403, 0, &started);
     return;
   }
 
-  /* Add `./` to the beginning of the requested path */
-  char* path = malloc(2 + strlen(request->path) + 1);
-  path[0] = '.';
-  path[1] = '/';
-  memcpy(path + 2, request->path, strlen(request->path) + 1);
+  /* Pick the site root from the Host header; `.` is server_files_directory. */
+  struct vhost* vhost = find_vhost(request->host);
+  char* host = vhost ? vhost->name : "";
+  char* root = vhost ? vhost->root : server_files_directory ? "." : NULL;
+  if (root == NULL) {
+    http_start_response(fd, 404);
+    http_send_header(fd, "Content-Type", "text/html");
+    http_end_headers(fd);
+    finish_request(fd, request, 404, 0, &started);
+    return;
+  }
+
+  /* Add the root to the beginning of the requested path */
+  char* path = malloc(strlen(root) + strlen(request->path) + 1);
+  strcpy(path, root);
+  strcat(path, request->path);
 
   /*
    * TODO: PART 2 is to serve files. If the file given by `path` exists,
@@ -118,9 +249,31 @@ void handle_files_request(int fd) {
 
   /* PART 2 & 3 BEGIN */
 
+  int status = 200;
+  size_t bytes = 0;
+  struct stat path_stat;
+  if (stat(path, &path_stat) == 0 && S_ISREG(path_stat.st_mode)) {
+    status = serve_file(fd, host, path, &bytes);
+  } else if (stat(path, &path_stat) == 0 && S_ISDIR(path_stat.st_mode)) {
+    char* index_path = malloc(strlen(path) + strlen("/index.html") + 1);
+    http_format_index(index_path, path);
+    struct stat index_stat;
+    if (stat(index_path, &index_stat) == 0 && S_ISREG(index_stat.st_mode))
+      status = serve_file(fd, host, index_path, &bytes);
+    else
+      bytes = serve_directory(fd, path, request->path);
+    free(index_path);
+  } else {
+    status = 404;
+    http_start_response(fd, 404);
+    http_send_header(fd, "Content-Type", "text/html");
+    http_end_headers(fd);
+  }
+  free(path);
+
   /* PART 2 & 3 END */
 
-  close(fd);
+  finish_request(fd, request, status, bytes, &started);
   return;
 }
 
@@ -139,6 +292,9 @@ void handle_files_request(int fd) {
  */
 void handle_proxy_request(int fd) {
 
+  struct timespec started;
+  clock_gettime(CLOCK_MONOTONIC, &started);
+
   /*
   * The code below does a DNS lookup of server_proxy_hostname and
   * opens a connection to it. Please do not modify.
@@ -175,13 +331,13 @@ void handle_proxy_request(int fd) {
 
   if (connection_status < 0) {
     /* Dummy request parsing, just to be compliant. */
-    http_request_parse(fd);
+    struct http_request* request = http_request_parse(fd);
 
     http_start_response(fd, 502);
     http_send_header(fd, "Content-Type", "text/html");
     http_end_headers(fd);
     close(target_fd);
-    close(fd);
+    finish_request(fd, request, 502, 0, &started);
     return;
   }
 
@@ -207,7 +363,11 @@ void* handle_clients(void* void_request_handler) {
   /* TODO: PART 7 */
   /* PART 7 BEGIN */
 
+  while (1)
+    request_handler(wq_pop(&work_queue));
+
   /* PART 7 END */
+  return NULL;
 }
 
 /*
@@ -218,6 +378,15 @@ void init_thread_pool(int num_threads, void (*request_handler)(int)) {
   /* TODO: PART 7 */
   /* PART 7 BEGIN */
 
+  wq_init(&work_queue);
+  for (int i = 0; i < num_threads; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, handle_clients, (void*)request_handler) != 0) {
+      perror("Failed to create worker thread");
+      exit(errno);
+    }
+  }
+
   /* PART 7 END */
 }
 #endif
@@ -227,6 +396,9 @@ void init_thread_pool(int num_threads, void (*request_handler)(int)) {
  * the fd number of the server socket in *socket_number. For each accepted
  * connection, calls request_handler with the accepted fd number.
  */
+int server_fd;
+volatile sig_atomic_t stop_signal; // Set by signal_callback_handler()
+
 void serve_forever(int* socket_number, void (*request_handler)(int)) {
 
   struct sockaddr_in server_address, client_address;
@@ -264,6 +436,16 @@ void serve_forever(int* socket_number, void (*request_handler)(int)) {
 
   /* PART 1 BEGIN */
 
+  if (bind(*socket_number, (struct sockaddr*)&server_address, sizeof(server_address)) == -1) {
+    perror("Failed to bind on socket");
+    exit(errno);
+  }
+
+  if (listen(*socket_number, 1024) == -1) {
+    perror("Failed to listen on socket");
+    exit(errno);
+  }
+
   /* PART 1 END */
   printf("Listening on port %d...\n", server_port);
 
@@ -275,16 +457,22 @@ void serve_forever(int* socket_number, void (*request_handler)(int)) {
   init_thread_pool(num_threads, request_handler);
 #endif
 
-  while (1) {
+  /* Threads started before now keep SIGINT blocked, so it interrupts accept(). */
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+
+  while (!stop_signal) {
     client_socket_number = accept(*socket_number, (struct sockaddr*)&client_address,
                                   (socklen_t*)&client_address_length);
     if (client_socket_number < 0) {
-      perror("Error accepting socket");
+      if (!stop_signal)
+        perror("Error accepting socket");
       continue;
     }
-
-    printf("Accepted connection from %s on port %d\n", inet_ntoa(client_address.sin_addr),
-           client_address.sin_port);
+    if (client_socket_number < HTTP_MAX_FDS)
+      client_addresses[client_socket_number] = client_address;
 
 #ifdef BASICSERVER
     /*
@@ -338,6 +526,8 @@ void serve_forever(int* socket_number, void (*request_handler)(int)) {
 
     /* PART 7 BEGIN */
 
+    wq_push(&work_queue, client_socket_number);
+
     /* PART 7 END */
 #endif
   }
@@ -346,18 +536,21 @@ void serve_forever(int* socket_number, void (*request_handler)(int)) {
   close(*socket_number);
 }
 
-int server_fd;
+/*
+ * Only async-signal-safe calls here: note the signal and wake up accept(),
+ * and let serve_forever() return to main() to shut down.
+ */
 void signal_callback_handler(int signum) {
-  printf("Caught signal %d: %s\n", signum, strsignal(signum));
-  printf("Closing socket %d\n", server_fd);
-  if (close(server_fd) < 0)
-    perror("Failed to close server_fd (ignoring)\n");
-  exit(0);
+  stop_signal = signum;
+  shutdown(server_fd, SHUT_RDWR);
 }
 
 char* USAGE =
     "Usage: ./httpserver --files some_directory/ [--port 8000 --num-threads 5]\n"
-    "       ./httpserver --proxy inst.eecs.berkeley.edu:80 [--port 8000 --num-threads 5]\n";
+    "       ./httpserver --proxy inst.eecs.berkeley.edu:80 [--port 8000 --num-threads 5]\n"
+    "Logging options: [--access-log FILE --log-sample N]\n"
+    "Virtual hosts (repeatable): [--vhost HOST=DIRECTORY] [--cache-size MB]\n"
+    "TLS options (make TLS=1, --files only): [--tls-cert CERT.pem --tls-key KEY.pem]\n";
 
 void exit_with_usage() {
   fprintf(stderr, "%s", USAGE);
@@ -365,7 +558,16 @@ void exit_with_usage() {
 }
 
 int main(int argc, char** argv) {
-  signal(SIGINT, signal_callback_handler);
+  /* No SA_RESTART, so that SIGINT makes accept() return. Until serve_forever()
+   * starts accepting, SIGINT stays blocked and waits. */
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = signal_callback_handler;
+  sigaction(SIGINT, &action, NULL);
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
   signal(SIGPIPE, SIG_IGN);
 
   /* Default settings */
@@ -412,6 +614,54 @@ int main(int argc, char** argv) {
         fprintf(stderr, "Expected positive integer after --num-threads\n");
         exit_with_usage();
       }
+    } else if (strcmp("--access-log", argv[i]) == 0) {
+      access_log_path = argv[++i];
+      if (!access_log_path) {
+        fprintf(stderr, "Expected argument after --access-log\n");
+        exit_with_usage();
+      }
+    } else if (strcmp("--log-sample", argv[i]) == 0) {
+      char* log_sample_str = argv[++i];
+      if (!log_sample_str || (access_log_sample = atoi(log_sample_str)) < 1) {
+        fprintf(stderr, "Expected positive integer after --log-sample\n");
+        exit_with_usage();
+      }
+    } else if (strcmp("--vhost", argv[i]) == 0) {
+      char* vhost_spec = argv[++i];
+      char* equals = vhost_spec ? strchr(vhost_spec, '=') : NULL;
+      if (!equals || equals == vhost_spec || num_vhosts == MAX_VHOSTS) {
+        fprintf(stderr, "Expected HOST=DIRECTORY after --vhost (at most %d)\n", MAX_VHOSTS);
+        exit_with_usage();
+      }
+      *equals = '\0';
+      vhosts[num_vhosts].name = vhost_spec;
+      /* Resolve now, since the server changes its working directory later. */
+      vhosts[num_vhosts].root = realpath(equals + 1, NULL);
+      if (!vhosts[num_vhosts].root) {
+        fprintf(stderr, "Cannot open directory for %s: %s\n", vhost_spec, equals + 1);
+        exit_with_usage();
+      }
+      num_vhosts++;
+      request_handler = handle_files_request;
+    } else if (strcmp("--cache-size", argv[i]) == 0) {
+      char* cache_size_str = argv[++i];
+      if (!cache_size_str || atoi(cache_size_str) < 0) {
+        fprintf(stderr, "Expected non-negative integer after --cache-size\n");
+        exit_with_usage();
+      }
+      file_cache_size = (size_t)atoi(cache_size_str) << 20;
+    } else if (strcmp("--tls-cert", argv[i]) == 0) {
+      tls_cert_path = argv[++i];
+      if (!tls_cert_path) {
+        fprintf(stderr, "Expected argument after --tls-cert\n");
+        exit_with_usage();
+      }
+    } else if (strcmp("--tls-key", argv[i]) == 0) {
+      tls_key_path = argv[++i];
+      if (!tls_key_path) {
+        fprintf(stderr, "Expected argument after --tls-key\n");
+        exit_with_usage();
+      }
     } else if (strcmp("--help", argv[i]) == 0) {
       exit_with_usage();
     } else {
@@ -420,7 +670,7 @@ int main(int argc, char** argv) {
     }
   }
 
-  if (server_files_directory == NULL && server_proxy_hostname == NULL) {
+  if (server_files_directory == NULL && server_proxy_hostname == NULL && num_vhosts == 0) {
     fprintf(stderr, "Please specify either \"--files [DIRECTORY]\" or \n"
                     "                      \"--proxy [HOSTNAME:PORT]\"\n");
     exit_with_usage();
@@ -433,8 +683,33 @@ int main(int argc, char** argv) {
   }
 #endif
 
-  chdir(server_files_directory);
+  if (tls_cert_path != NULL || tls_key_path != NULL) {
+    if (tls_cert_path == NULL || tls_key_path == NULL || request_handler != handle_files_request) {
+      fprintf(stderr, "TLS needs --tls-cert, --tls-key and --files\n");
+      exit_with_usage();
+    }
+#ifdef HTTPS
+    if (tls_init(tls_cert_path, tls_key_path, request_handler) < 0)
+      exit(EXIT_FAILURE);
+    request_handler = tls_request_handler;
+#else
+    fprintf(stderr, "This server was built without TLS support (use make TLS=1)\n");
+    exit(EXIT_FAILURE);
+#endif
+  }
+
+  if (access_log_init(access_log_path, access_log_sample) < 0) {
+    perror("Failed to open access log");
+    exit(errno);
+  }
+
+  filecache_init(file_cache_size, FILE_CACHE_MAX_FILE_SIZE);
+  if (server_files_directory != NULL)
+    chdir(server_files_directory);
   serve_forever(&server_fd, request_handler);
 
+  printf("Caught signal %d: %s\n", stop_signal, strsignal(stop_signal));
+  printf("Closed socket %d\n", server_fd);
+  access_log_flush();
   return EXIT_SUCCESS;
 }
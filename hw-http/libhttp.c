@@ -1,12 +1,36 @@
 #include <errno.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/sendfile.h>
 #include <unistd.h>
 
 #include "libhttp.h"
 
 #define LIBHTTP_REQUEST_MAX_SIZE 8192
+#define LIBHTTP_LINE_MAX_SIZE 1024
+#define LIBHTTP_COPY_BUFFER_SIZE 65536
+
+/* Transport in use on each connection, or NULL for a plain socket. */
+static struct http_transport* http_transports[HTTP_MAX_FDS];
+
+static struct http_transport* http_get_transport(int fd) {
+  return (fd >= 0 && fd < HTTP_MAX_FDS) ? http_transports[fd] : NULL;
+}
+
+int http_set_transport(int fd, struct http_transport* transport) {
+  if (fd < 0 || fd >= HTTP_MAX_FDS)
+    return -1;
+  http_transports[fd] = transport;
+  return 0;
+}
+
+static ssize_t http_read(int fd, void* buffer, size_t size) {
+  struct http_transport* transport = http_get_transport(fd);
+  return transport ? transport->read(fd, buffer, size) : read(fd, buffer, size);
+}
 
 void http_fatal_error(char* message) {
   fprintf(stderr, "%s\n", message);
@@ -17,12 +41,17 @@ struct http_request* http_request_parse(int fd) {
   struct http_request* request = malloc(sizeof(struct http_request));
   if (!request)
     http_fatal_error("Malloc failed");
+  request->method = NULL;
+  request->path = NULL;
+  request->host = NULL;
 
   char* read_buffer = malloc(LIBHTTP_REQUEST_MAX_SIZE + 1);
   if (!read_buffer)
     http_fatal_error("Malloc failed");
 
-  int bytes_read = read(fd, read_buffer, LIBHTTP_REQUEST_MAX_SIZE);
+  int bytes_read = http_read(fd, read_buffer, LIBHTTP_REQUEST_MAX_SIZE);
+  if (bytes_read < 0)
+    bytes_read = 0;
   read_buffer[bytes_read] = '\0'; /* Always null-terminate. */
 
   char *read_start, *read_end;
@@ -65,16 +94,44 @@ struct http_request* http_request_parse(int fd) {
       break;
     read_end++;
 
+    /* Read in header lines up to the blank line, keeping only Host. */
+    while (*read_end != '\0' && *read_end != '\r' && *read_end != '\n') {
+      read_start = read_end;
+      while (*read_end != '\0' && *read_end != '\n')
+        read_end++;
+      if (strncasecmp(read_start, "Host:", 5) == 0 && request->host == NULL) {
+        char* value_start = read_start + 5;
+        char* value_end = read_end;
+        while (*value_start == ' ' || *value_start == '\t')
+          value_start++;
+        while (value_end > value_start && (value_end[-1] == '\r' || value_end[-1] == ' '))
+          value_end--;
+        request->host = strndup(value_start, value_end - value_start);
+      }
+      if (*read_end == '\n')
+        read_end++;
+    }
+
     free(read_buffer);
     return request;
   } while (0);
 
   /* An error occurred. */
-  free(request);
+  http_request_free(request);
   free(read_buffer);
   return NULL;
 }
 
+/* Frees a request returned by http_request_parse(), which may be NULL. */
+void http_request_free(struct http_request* request) {
+  if (request == NULL)
+    return;
+  free(request->method);
+  free(request->path);
+  free(request->host);
+  free(request);
+}
+
 char* http_get_response_message(int status_code) {
   switch (status_code) {
     case 100:
@@ -102,13 +159,96 @@ char* http_get_response_message(int status_code) {
   }
 }
 
+void http_send_data(int fd, char* data, size_t size) {
+  struct http_transport* transport = http_get_transport(fd);
+  while (size > 0) {
+    ssize_t written = transport ? transport->write(fd, data, size) : write(fd, data, size);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return;
+    data += written;
+    size -= written;
+  }
+}
+
+void http_send_string(int fd, char* data) { http_send_data(fd, data, strlen(data)); }
+
+/* Formats a line of at most LIBHTTP_LINE_MAX_SIZE bytes and sends it. */
+static void http_send_line(int fd, char* format, ...) {
+  char line[LIBHTTP_LINE_MAX_SIZE];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  if (length < 0)
+    return;
+  http_send_data(fd, line, (size_t)length < sizeof(line) ? (size_t)length : sizeof(line) - 1);
+}
+
 void http_start_response(int fd, int status_code) {
-  dprintf(fd, "HTTP/1.0 %d %s\r\n", status_code, http_get_response_message(status_code));
+  http_send_line(fd, "HTTP/1.0 %d %s\r\n", status_code, http_get_response_message(status_code));
 }
 
-void http_send_header(int fd, char* key, char* value) { dprintf(fd, "%s: %s\r\n", key, value); }
+void http_send_header(int fd, char* key, char* value) { http_send_line(fd, "%s: %s\r\n", key, value); }
+
+void http_end_headers(int fd) { http_send_data(fd, "\r\n", 2); }
+
+/*
+ * Sends SIZE bytes of FILE_FD, starting at its beginning, as the response
+ * body. The kernel copies the data directly when it can; otherwise it goes
+ * through a user-space buffer. Returns 0 on success and -1 on error.
+ */
+int http_send_file(int fd, int file_fd, size_t size) {
+  struct http_transport* transport = http_get_transport(fd);
+  off_t offset = 0;
 
-void http_end_headers(int fd) { dprintf(fd, "\r\n"); }
+  while ((size_t)offset < size) {
+    ssize_t sent;
+    if (transport == NULL) {
+      sent = sendfile(fd, file_fd, &offset, size - offset);
+    } else if (transport->sendfile != NULL) {
+      sent = transport->sendfile(fd, file_fd, offset, size - offset);
+      if (sent > 0)
+        offset += sent;
+    } else {
+      break;
+    }
+    if (sent < 0 && errno == EINTR)
+      continue;
+    if (sent < 0 && (errno == ENOSYS || errno == EINVAL) && offset == 0)
+      break;
+    if (sent <= 0)
+      return -1;
+  }
+
+  /* Fall back to copying whatever the kernel could not send for us. */
+  char* buffer = NULL;
+  while ((size_t)offset < size) {
+    if (buffer == NULL && (buffer = malloc(LIBHTTP_COPY_BUFFER_SIZE)) == NULL)
+      return -1;
+    size_t chunk = size - offset < LIBHTTP_COPY_BUFFER_SIZE ? size - offset : LIBHTTP_COPY_BUFFER_SIZE;
+    ssize_t bytes_read = pread(file_fd, buffer, chunk, offset);
+    if (bytes_read <= 0) {
+      free(buffer);
+      return -1;
+    }
+    http_send_data(fd, buffer, bytes_read);
+    offset += bytes_read;
+  }
+  free(buffer);
+  return 0;
+}
+
+/* Shuts down the connection's transport, if any, and closes FD. */
+void http_close(int fd) {
+  struct http_transport* transport = http_get_transport(fd);
+  if (transport != NULL) {
+    transport->close(fd);
+    http_set_transport(fd, NULL);
+  }
+  close(fd);
+}
 
 char* http_get_mime_type(char* file_name) {
   char* file_extension = strrchr(file_name, '.');
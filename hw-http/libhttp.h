@@ -20,15 +20,23 @@
 #ifndef LIBHTTP_H
 #define LIBHTTP_H
 
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Connections on file descriptors at or above this cannot use a transport. */
+#define HTTP_MAX_FDS 65536
+
 /*
  * Functions for parsing an HTTP request.
  */
 struct http_request {
   char* method;
   char* path;
+  char* host; /* Value of the Host header, or NULL if there was none. */
 };
 
 struct http_request* http_request_parse(int fd);
+void http_request_free(struct http_request* request);
 
 /*
  * Functions for sending an HTTP response.
@@ -36,6 +44,10 @@ struct http_request* http_request_parse(int fd);
 void http_start_response(int fd, int status_code);
 void http_send_header(int fd, char* key, char* value);
 void http_end_headers(int fd);
+void http_send_string(int fd, char* data);
+void http_send_data(int fd, char* data, size_t size);
+int http_send_file(int fd, int file_fd, size_t size);
+void http_close(int fd);
 void http_format_href(char* buffer, char* path, char* filename);
 void http_format_index(char* buffer, char* path);
 
@@ -44,4 +56,21 @@ void http_format_index(char* buffer, char* path);
  */
 char* http_get_mime_type(char* file_name);
 
+/*
+ * Pluggable transport. By default requests are read from and responses are
+ * written to the socket directly. A transport (such as TLS) can take over
+ * the I/O of a connection with http_set_transport(); every function above
+ * then goes through its hooks until http_close() is called. `sendfile` may
+ * be NULL or fail with ENOSYS, in which case file bodies are copied through
+ * `write`.
+ */
+struct http_transport {
+  ssize_t (*read)(int fd, void* buffer, size_t size);
+  ssize_t (*write)(int fd, const void* buffer, size_t size);
+  ssize_t (*sendfile)(int fd, int file_fd, off_t offset, size_t size);
+  void (*close)(int fd);
+};
+
+int http_set_transport(int fd, struct http_transport* transport);
+
 #endif
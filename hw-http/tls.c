@@ -0,0 +1,104 @@
+#include <errno.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "libhttp.h"
+#include "tls.h"
+
+static SSL_CTX* tls_context;
+static void (*tls_handler)(int);
+
+/* Session of each TLS connection, indexed like libhttp's transports. */
+static SSL* tls_sessions[HTTP_MAX_FDS];
+
+static ssize_t tls_read(int fd, void* buffer, size_t size) {
+  size_t bytes_read;
+  int result = SSL_read_ex(tls_sessions[fd], buffer, size, &bytes_read);
+  if (result <= 0)
+    return SSL_get_error(tls_sessions[fd], result) == SSL_ERROR_ZERO_RETURN ? 0 : -1;
+  return bytes_read;
+}
+
+static ssize_t tls_write(int fd, const void* buffer, size_t size) {
+  size_t written;
+  if (SSL_write_ex(tls_sessions[fd], buffer, size, &written) <= 0)
+    return -1;
+  return written;
+}
+
+/* Only possible when kTLS is handling the record layer for this socket. */
+static ssize_t tls_sendfile(int fd, int file_fd, off_t offset, size_t size) {
+  SSL* ssl = tls_sessions[fd];
+  if (!BIO_get_ktls_send(SSL_get_wbio(ssl))) {
+    errno = ENOSYS;
+    return -1;
+  }
+  return SSL_sendfile(ssl, file_fd, offset, size, 0);
+}
+
+static void tls_close(int fd) {
+  SSL_shutdown(tls_sessions[fd]);
+  SSL_free(tls_sessions[fd]);
+  tls_sessions[fd] = NULL;
+}
+
+static struct http_transport tls_transport = {
+    .read = tls_read,
+    .write = tls_write,
+    .sendfile = tls_sendfile,
+    .close = tls_close,
+};
+
+int tls_init(char* cert_path, char* key_path, void (*handler)(int)) {
+  tls_context = SSL_CTX_new(TLS_server_method());
+  if (tls_context == NULL) {
+    ERR_print_errors_fp(stderr);
+    return -1;
+  }
+
+  SSL_CTX_set_min_proto_version(tls_context, TLS1_2_VERSION);
+#ifdef SSL_OP_ENABLE_KTLS
+  SSL_CTX_set_options(tls_context, SSL_OP_ENABLE_KTLS);
+#endif
+
+  /*
+   * Resumption: stateless tickets (the default ticket keys are created here,
+   * before any fork, so every worker can decrypt every ticket) plus the
+   * internal session cache for TLS 1.2 clients that only send a session ID.
+   */
+  SSL_CTX_clear_options(tls_context, SSL_OP_NO_TICKET);
+  SSL_CTX_set_session_cache_mode(tls_context, SSL_SESS_CACHE_SERVER);
+  SSL_CTX_set_session_id_context(tls_context, (unsigned char*)"httpserver", 10);
+
+  if (SSL_CTX_use_certificate_chain_file(tls_context, cert_path) <= 0 ||
+      SSL_CTX_use_PrivateKey_file(tls_context, key_path, SSL_FILETYPE_PEM) <= 0 ||
+      SSL_CTX_check_private_key(tls_context) <= 0) {
+    ERR_print_errors_fp(stderr);
+    SSL_CTX_free(tls_context);
+    tls_context = NULL;
+    return -1;
+  }
+
+  tls_handler = handler;
+  return 0;
+}
+
+void tls_request_handler(int fd) {
+  if (fd >= HTTP_MAX_FDS) {
+    close(fd);
+    return;
+  }
+
+  SSL* ssl = SSL_new(tls_context);
+  if (ssl == NULL || SSL_set_fd(ssl, fd) <= 0 || SSL_accept(ssl) <= 0) {
+    SSL_free(ssl);
+    close(fd);
+    return;
+  }
+
+  tls_sessions[fd] = ssl;
+  http_set_transport(fd, &tls_transport);
+  tls_handler(fd);
+}
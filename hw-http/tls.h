@@ -0,0 +1,26 @@
+#ifndef __TLS__
+#define __TLS__
+
+/*
+ * TLS termination for httpserver, built with `make TLS=1`.
+ *
+ * tls_request_handler() performs the handshake on a freshly accepted socket,
+ * installs a libhttp transport so the wrapped handler's reads and writes are
+ * encrypted, and then runs the wrapped handler unchanged. Sessions can be
+ * resumed with stateless session tickets, so resumption also works across
+ * forkserver children and pool threads. When the kernel supports kTLS the
+ * record layer is offloaded after the handshake and file bodies go out with
+ * sendfile.
+ */
+
+/*
+ * Loads the certificate chain and private key (PEM files) and remembers
+ * HANDLER as the function that serves each connection once the handshake is
+ * done. Returns 0 on success and -1 on error (reported on stderr).
+ */
+int tls_init(char* cert_path, char* key_path, void (*handler)(int));
+
+/* Handshakes on FD and passes it to the handler given to tls_init(). */
+void tls_request_handler(int fd);
+
+#endif
@@ -0,0 +1,125 @@
+/*
+ * Handshake-rate benchmark for httpserver's TLS listener.
+ *
+ * Usage: ./tlsbench HOST PORT [CONNECTIONS] [PATH]
+ *
+ * Makes CONNECTIONS sequential HTTPS requests for PATH twice: once with a
+ * full handshake each time, and once offering the session from the previous
+ * connection so the server can resume it. Reports handshakes per second and
+ * how many sessions the server actually resumed.
+ */
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+static struct sockaddr_in server_address;
+static char request[1024];
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Runs one request, offering *SESSION for resumption if it is not NULL and
+ * replacing it with the new session afterwards. Returns 1 if the session was
+ * resumed, 0 if not, and -1 on error.
+ */
+static int run_request(SSL_CTX* context, SSL_SESSION** session) {
+  int fd = socket(PF_INET, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr*)&server_address, sizeof(server_address)) < 0) {
+    perror("connect");
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+
+  SSL* ssl = SSL_new(context);
+  SSL_set_fd(ssl, fd);
+  if (*session != NULL)
+    SSL_set_session(ssl, *session);
+
+  int result = -1;
+  if (SSL_connect(ssl) > 0 && SSL_write(ssl, request, strlen(request)) > 0) {
+    /* Read the whole response; TLS 1.3 tickets arrive along with it. */
+    char buffer[16384];
+    while (SSL_read(ssl, buffer, sizeof(buffer)) > 0)
+      ;
+    /* A session is only kept resumable after a clean shutdown. */
+    SSL_shutdown(ssl);
+    result = SSL_session_reused(ssl);
+    if (*session != NULL)
+      SSL_SESSION_free(*session);
+    *session = SSL_get1_session(ssl);
+  } else {
+    ERR_print_errors_fp(stderr);
+  }
+
+  SSL_free(ssl);
+  close(fd);
+  return result;
+}
+
+static int run_benchmark(SSL_CTX* context, int connections, int resume) {
+  SSL_SESSION* session = NULL;
+  int resumed = 0;
+
+  double start = now();
+  for (int i = 0; i < connections; i++) {
+    int result = run_request(context, &session);
+    if (result < 0)
+      return -1;
+    resumed += result;
+    if (!resume && session != NULL) {
+      SSL_SESSION_free(session);
+      session = NULL;
+    }
+  }
+  double elapsed = now() - start;
+
+  printf("%-7s %8.1f handshakes/s  %d/%d resumed\n", resume ? "resumed" : "full",
+         connections / elapsed, resumed, connections);
+  if (session != NULL)
+    SSL_SESSION_free(session);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(stderr, "Usage: %s HOST PORT [CONNECTIONS] [PATH]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  int connections = argc > 3 ? atoi(argv[3]) : 1000;
+  char* path = argc > 4 ? argv[4] : "/";
+
+  struct hostent* host = gethostbyname2(argv[1], AF_INET);
+  if (host == NULL) {
+    fprintf(stderr, "Cannot find host: %s\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  memset(&server_address, 0, sizeof(server_address));
+  server_address.sin_family = AF_INET;
+  server_address.sin_port = htons(atoi(argv[2]));
+  memcpy(&server_address.sin_addr, host->h_addr_list[0], sizeof(server_address.sin_addr));
+  snprintf(request, sizeof(request), "GET %s HTTP/1.0\r\nHost: %s\r\n\r\n", path, argv[1]);
+
+  /* The benchmark measures the server, so certificates are not verified. */
+  SSL_CTX* context = SSL_CTX_new(TLS_client_method());
+  SSL_CTX_set_verify(context, SSL_VERIFY_NONE, NULL);
+  SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_CLIENT);
+
+  if (run_benchmark(context, connections, 0) < 0 || run_benchmark(context, connections, 1) < 0)
+    return EXIT_FAILURE;
+
+  SSL_CTX_free(context);
+  return EXIT_SUCCESS;
+}
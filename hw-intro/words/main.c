@@ -29,6 +29,14 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <ctype.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "word_count.h"
 
@@ -110,6 +118,117 @@ int count_words(WordCount **wclist, FILE *infile) {
   return 0;
 }
 
+/* Bytes classified at a time by scan_words(). */
+#define BLOCK_SIZE 16
+
+/*
+ * Sets out to the BLOCK_SIZE bytes at in, lowercased, and returns a bitmask
+ * of which of them are letters. With the case bit set, letters are 'a'
+ * through 'z'; adding 0x80 - 'a' moves them to the bottom of the signed
+ * bytes, where one signed compare picks them out.
+ */
+static unsigned classify_block(const char *in, char *out) {
+#ifdef __SSE2__
+  const __m128i case_bit = _mm_set1_epi8(0x20);
+  __m128i c = _mm_loadu_si128((const __m128i *) in);
+  __m128i folded = _mm_or_si128(c, case_bit);
+  __m128i letter = _mm_cmplt_epi8(_mm_add_epi8(folded, _mm_set1_epi8((char) (0x80 - 'a'))),
+                                  _mm_set1_epi8((char) (0x80 + 26)));
+  _mm_storeu_si128((__m128i *) out, _mm_or_si128(c, _mm_and_si128(letter, case_bit)));
+  return _mm_movemask_epi8(letter);
+#else
+  unsigned letters = 0;
+  for (int i = 0; i < BLOCK_SIZE; i++) {
+    unsigned char folded = in[i] | 0x20;
+    bool is_letter = (unsigned char) (folded - 'a') < 26;
+    out[i] = is_letter ? folded : in[i];
+    letters |= (unsigned) is_letter << i;
+  }
+  return letters;
+#endif
+}
+
+/*
+ * Does what count_words() does, or num_words() if wclist is NULL, for the
+ * size bytes at data, a BLOCK_SIZE bytes at a time. Returns the number of
+ * words, or -1 on error.
+ */
+static int scan_words(WordCount **wclist, const char *data, size_t size) {
+  char word[MAX_WORD_LEN + 1];
+  char lower[BLOCK_SIZE];
+  char tail[BLOCK_SIZE];
+  int word_len = 0;
+  int words = 0;
+
+  for (size_t offset = 0; offset < size; offset += BLOCK_SIZE) {
+    const char *block = data + offset;
+    if (size - offset < BLOCK_SIZE) {
+      memset(tail, ' ', BLOCK_SIZE);
+      memcpy(tail, block, size - offset);
+      block = tail;
+    }
+    unsigned letters = classify_block(block, lower);
+
+    int pos = 0;
+    while (pos < BLOCK_SIZE) {
+      unsigned rest = letters >> pos;
+      if (rest & 1) {
+        // A run of letters, which may carry on into the next block.
+        int run = __builtin_ctz(~rest);
+        int keep = run < MAX_WORD_LEN - word_len ? run : MAX_WORD_LEN - word_len;
+        memcpy(word + word_len, lower + pos, keep);
+        word_len += keep;
+        pos += run;
+        continue;
+      }
+      if (word_len >= 2) {
+        word[word_len] = '\0';
+        if (wclist != NULL && add_word(wclist, word) != 0) {
+          return -1;
+        }
+        words++;
+      }
+      word_len = 0;
+      if (rest == 0) {
+        break;
+      }
+      pos += __builtin_ctz(rest);
+    }
+  }
+  if (word_len >= 2) {
+    word[word_len] = '\0';
+    if (wclist != NULL && add_word(wclist, word) != 0) {
+      return -1;
+    }
+    words++;
+  }
+  return words;
+}
+
+/*
+ * Maps the regular file at path into memory and sets *size. Returns NULL if
+ * it can't be mapped, including when it is empty, for the caller to read it
+ * with stdio instead.
+ */
+static char *map_file(const char *path, size_t *size) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  char *data = NULL;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      data = NULL;
+    } else {
+      *size = st.st_size;
+    }
+  }
+  close(fd);
+  return data;
+}
+
 /*
  * Comparator to sort list by frequency.
  * Useful function: strcmp().
@@ -127,6 +246,8 @@ static int display_help(void) {
 	printf("Flags:\n"
 	    "--count (-c): Count the total amount of words in the file, or STDIN if a file is not specified. This is default behavior if no flag is specified.\n"
 	    "--frequency (-f): Count the frequency of each word in the file, or STDIN if a file is not specified.\n"
+	    "--memory (-m): With --frequency, report the memory used by the word list on STDERR.\n"
+	    "--top N (-t N): Like --frequency, but print only the N most frequent words.\n"
 	    "--help (-h): Displays this help message.\n");
 	return 0;
 }
@@ -143,6 +264,12 @@ int main (int argc, char *argv[]) {
   // Freq Mode: outputs the frequency of each word
   bool freq_mode = false;
 
+  // Memory report: with freq mode, prints the word list's memory use to stderr
+  bool memory = false;
+
+  // Top mode: freq mode, printing only the top_words most frequent words
+  int top_words = 0;
+
   // FILE *infile = NULL;
 
   // Variables for command line argument parsing
@@ -151,12 +278,14 @@ int main (int argc, char *argv[]) {
   {
       {"count", no_argument, 0, 'c'},
       {"frequency", no_argument, 0, 'f'},
+      {"memory", no_argument, 0, 'm'},
+      {"top", required_argument, 0, 't'},
       {"help", no_argument, 0, 'h'},
       {0, 0, 0, 0}
   };
 
   // Sets flags
-  while ((i = getopt_long(argc, argv, "cfh", long_options, NULL)) != -1) {
+  while ((i = getopt_long(argc, argv, "cfmt:h", long_options, NULL)) != -1) {
       switch (i) {
           case 'c':
               count_mode = true;
@@ -166,6 +295,17 @@ int main (int argc, char *argv[]) {
               count_mode = false;
               freq_mode = true;
               break;
+          case 'm':
+              memory = true;
+              break;
+          case 't':
+              top_words = atoi(optarg);
+              if (top_words <= 0) {
+                return display_help();
+              }
+              count_mode = false;
+              freq_mode = true;
+              break;
           case 'h':
               return display_help();
       }
@@ -194,6 +334,20 @@ int main (int argc, char *argv[]) {
     // The first file can be found at argv[optind]. The last file can be
     // found at argv[argc-1].
     for (int j = optind; j < argc; j++) {
+      // Scan mapped files a block at a time, instead of a byte at a time.
+      size_t size;
+      char *data = map_file(argv[j], &size);
+      if (data != NULL) {
+        int words = scan_words(count_mode ? NULL : &word_counts, data, size);
+        munmap(data, size);
+        if (words < 0) {
+          fprintf(stderr, "Error reading file: %s\n", argv[j]);
+        } else if (count_mode) {
+          total_words += words;
+        }
+        continue;
+      }
+
       FILE *file = fopen(argv[j], "r");
       if (!file) {
         fprintf(stderr, "Failed to open file: %s\n", argv[j]);
@@ -217,10 +371,21 @@ int main (int argc, char *argv[]) {
   if (count_mode) {
     printf("The total number of words is: %i\n", total_words);
   } else {
-    wordcount_sort(&word_counts, wordcount_less);
-
     printf("The frequencies of each word are: \n");
-    fprint_words(word_counts, stdout);
+    if (top_words > 0) {
+      if (fprint_top_words(word_counts, top_words, wordcount_less, stdout) != 0) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+      }
+    } else {
+      wordcount_sort(&word_counts, wordcount_less);
+      fprint_words(word_counts, stdout);
+    }
+    if (memory) {
+      fprint_memory_usage(word_counts, stderr);
+    }
+    free_all_words();
+    init_words(&word_counts);
 }
   return 0;
 }
@@ -20,12 +20,67 @@ Functional methods take the head of a list as first arg.
 Mutators take a reference to a list as first arg.
 */
 
+#include <stdint.h>
+
 #include "word_count.h"
 
 /* Basic utilities */
 
+/*
+ * Nodes and their words are carved out of large blocks by bumping a pointer,
+ * instead of two malloc() calls per word, and free_all_words() releases all
+ * the blocks at once. Every list shares the same blocks, so they are freed
+ * together rather than list by list.
+ */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct arena_block {
+  struct arena_block *next;
+} ArenaBlock;
+
+static ArenaBlock *arena_blocks = NULL;
+static char *arena_next = NULL;
+static char *arena_end = NULL;
+
+/* What the arena has handed out, and what the same requests would cost from malloc(). */
+static size_t arena_allocations = 0;
+static size_t arena_requested = 0;
+static size_t arena_reserved = 0;
+static size_t arena_malloc_bytes = 0;
+
+/*
+ * Bytes glibc's malloc() takes for a size-byte request on a 64-bit system:
+ * an 8-byte header, rounded up to 16, and at least 32.
+ */
+static size_t malloc_chunk_size(size_t size) {
+  size_t chunk = (size + 8 + 15) & ~(size_t) 15;
+  return chunk < 32 ? 32 : chunk;
+}
+
+/* Returns size bytes aligned to align, a power of two, or NULL. */
+static void *arena_alloc(size_t size, size_t align) {
+  uintptr_t start = ((uintptr_t) arena_next + align - 1) & ~(uintptr_t) (align - 1);
+  if (arena_next == NULL || start + size > (uintptr_t) arena_end) {
+    size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    ArenaBlock *block = malloc(sizeof(ArenaBlock) + block_size);
+    if (block == NULL) {
+      return NULL;
+    }
+    block->next = arena_blocks;
+    arena_blocks = block;
+    arena_reserved += malloc_chunk_size(sizeof(ArenaBlock) + block_size);
+    start = (uintptr_t) (block + 1);
+    arena_end = (char *) (block + 1) + block_size;
+  }
+  arena_next = (char *) start + size;
+  arena_allocations++;
+  arena_requested += size;
+  arena_malloc_bytes += malloc_chunk_size(size);
+  return (void *) start;
+}
+
 char *new_string(char *str) {
-  char *new_str = (char *) malloc(strlen(str) + 1);
+  char *new_str = arena_alloc(strlen(str) + 1, 1);
   if (new_str == NULL) {
     return NULL;
   }
@@ -81,12 +136,11 @@ int add_word(WordCount **wclist, char *word) {
     return 0;
   }
 
-  WordCount *new_node = malloc(sizeof(WordCount));
+  WordCount *new_node = arena_alloc(sizeof(WordCount), _Alignof(WordCount));
   if (new_node == NULL) return 1;
 
   new_node->word = new_string(word);
   if (new_node->word == NULL) {
-    free(new_node);
     return 1;
   }
 
@@ -99,6 +153,28 @@ int add_word(WordCount **wclist, char *word) {
  return 0;
 }
 
+void free_all_words(void) {
+  while (arena_blocks != NULL) {
+    ArenaBlock *next = arena_blocks->next;
+    free(arena_blocks);
+    arena_blocks = next;
+  }
+  arena_next = NULL;
+  arena_end = NULL;
+  arena_allocations = 0;
+  arena_requested = 0;
+  arena_reserved = 0;
+  arena_malloc_bytes = 0;
+}
+
+void fprint_memory_usage(WordCount *wchead, FILE *ofile) {
+  fprintf(ofile, "%zd words: %zu allocations of %zu bytes\n", len_words(wchead),
+          arena_allocations, arena_requested);
+  fprintf(ofile, "arena:  %zu bytes\n", arena_reserved);
+  fprintf(ofile, "malloc: %zu bytes\n", arena_malloc_bytes);
+  fprintf(ofile, "saved:  %ld bytes\n", (long) arena_malloc_bytes - (long) arena_reserved);
+}
+
 void fprint_words(WordCount *wchead, FILE *ofile) {
   /* print word counts to a file */
   WordCount *wc;
@@ -106,3 +182,78 @@ void fprint_words(WordCount *wchead, FILE *ofile) {
     fprintf(ofile, "%i\t%s\n", wc->count, wc->word);
   }
 }
+
+/*
+ * The k greatest word counts under less seen so far, as a min-heap, so each
+ * word costs one compare against the root and, if it gets in, O(log k).
+ */
+typedef struct top_heap {
+  WordCount **items;
+  int size;
+  bool (*less)(const WordCount *, const WordCount *);
+} TopHeap;
+
+static void top_swap(TopHeap *heap, int i, int j) {
+  WordCount *tmp = heap->items[i];
+  heap->items[i] = heap->items[j];
+  heap->items[j] = tmp;
+}
+
+/* Restores the heap below i, which may be greater than its children. */
+static void top_sift_down(TopHeap *heap, int i) {
+  for (;;) {
+    int least = i;
+    int left = 2 * i + 1;
+    int right = left + 1;
+    if (left < heap->size && heap->less(heap->items[left], heap->items[least])) {
+      least = left;
+    }
+    if (right < heap->size && heap->less(heap->items[right], heap->items[least])) {
+      least = right;
+    }
+    if (least == i) {
+      return;
+    }
+    top_swap(heap, i, least);
+    i = least;
+  }
+}
+
+static void top_sift_up(TopHeap *heap, int i) {
+  while (i > 0 && heap->less(heap->items[i], heap->items[(i - 1) / 2])) {
+    top_swap(heap, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+int fprint_top_words(WordCount *wchead, int k, bool less(const WordCount *, const WordCount *),
+                     FILE *ofile) {
+  if (k <= 0) {
+    return 0;
+  }
+  TopHeap heap = {malloc(k * sizeof(WordCount *)), 0, less};
+  if (heap.items == NULL) {
+    return 1;
+  }
+  for (WordCount *wc = wchead; wc != NULL; wc = wc->next) {
+    if (heap.size < k) {
+      heap.items[heap.size++] = wc;
+      top_sift_up(&heap, heap.size - 1);
+    } else if (less(heap.items[0], wc)) {
+      heap.items[0] = wc;
+      top_sift_down(&heap, 0);
+    }
+  }
+
+  /* Popping the least to the back leaves the greatest first. */
+  int n = heap.size;
+  while (heap.size > 1) {
+    top_swap(&heap, 0, --heap.size);
+    top_sift_down(&heap, 0);
+  }
+  for (int i = n - 1; i >= 0; i--) {
+    fprintf(ofile, "%i\t%s\n", heap.items[i]->count, heap.items[i]->word);
+  }
+  free(heap.items);
+  return 0;
+}
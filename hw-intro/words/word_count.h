@@ -60,12 +60,24 @@ int add_word(WordCount **wclist, char *word);
 
 //static int wordcntcmp(const WordCount *wc1, WordCount *wc2);
 
+/* Free the words of every list at once, since all lists share one arena.
+   Every list is left dangling; call init_words() on any list reused after. */
+void free_all_words(void);
+
+/* print the arena's memory use, and what malloc() would have used, to a file */
+void fprint_memory_usage(WordCount *wchead, FILE *ofile);
+
 /* print word counts to a file */
 void fprint_words(WordCount *wchead, FILE *ofile);
 
 /* Inserts a word into the list in order. Assumes the existing list is already sorted */
 void wordcount_insert_ordered(WordCount **wclist, WordCount *elem, bool less(const WordCount *, const WordCount *));
 
+/* print the k word counts that sort last under less, in the order a sort
+   and fprint_words would print them, without sorting the list.
+   Returns 0 if no errors are encountered; 1 otherwise. */
+int fprint_top_words(WordCount *wchead, int k, bool less(const WordCount *, const WordCount *), FILE *ofile);
+
 /* Sort a word count list in place */
 void wordcount_sort(WordCount **wclist, bool less(const WordCount *, const WordCount *));
 
@@ -0,0 +1,65 @@
+/*
+ * Implementation of the arena interface.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ALIGNMENT sizeof(void*)
+
+/*
+ * Bytes glibc's malloc() takes for a SIZE-byte request on a 64-bit system:
+ * an 8-byte header, rounded up to 16, and at least 32.
+ */
+static size_t malloc_chunk_size(size_t size) {
+  size_t chunk = (size + 8 + 15) & ~(size_t)15;
+  return chunk < 32 ? 32 : chunk;
+}
+
+void arena_init(arena_t* arena) { memset(arena, 0, sizeof(*arena)); }
+
+/* Allocates SIZE bytes at a multiple of ALIGN, which is a power of two. */
+static void* allocate(arena_t* arena, size_t size, size_t align) {
+  char* start = (char*)(((uintptr_t)arena->next + align - 1) & ~(uintptr_t)(align - 1));
+  if (arena->next == NULL || size > (size_t)(arena->end - start)) {
+    size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    arena_block_t* block = malloc(sizeof(arena_block_t) + block_size);
+    if (block == NULL)
+      return NULL;
+    block->next = arena->blocks;
+    block->size = block_size;
+    arena->blocks = block;
+    arena->reserved += malloc_chunk_size(sizeof(arena_block_t) + block_size);
+    start = block->data;
+    arena->end = block->data + block_size;
+  }
+  arena->next = start + size;
+  arena->allocations++;
+  arena->requested += size;
+  arena->malloc_bytes += malloc_chunk_size(size);
+  return start;
+}
+
+void* arena_alloc(arena_t* arena, size_t size) { return allocate(arena, size, ALIGNMENT); }
+
+char* arena_strndup(arena_t* arena, const char* str, size_t len) {
+  char* copy = allocate(arena, len + 1, 1);
+  if (copy == NULL)
+    return NULL;
+  memcpy(copy, str, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+void arena_destroy(arena_t* arena) {
+  arena_block_t* block = arena->blocks;
+  while (block != NULL) {
+    arena_block_t* next = block->next;
+    free(block);
+    block = next;
+  }
+  arena_init(arena);
+}
@@ -0,0 +1,43 @@
+/*
+ * The arena interface hands out memory by bumping a pointer through large
+ * blocks, and frees all of it at once. It keeps the numbers needed to
+ * compare it against allocating each object with malloc().
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* Usable bytes in each block; larger requests get a block of their own. */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct arena_block {
+  struct arena_block* next;
+  size_t size;
+  char data[];
+} arena_block_t;
+
+typedef struct arena {
+  arena_block_t* blocks; /* Most recent first. */
+  char* next;            /* Free space in the most recent block. */
+  char* end;
+  size_t allocations;
+  size_t requested;    /* Bytes asked for. */
+  size_t reserved;     /* Bytes malloc'd for blocks, headers included. */
+  size_t malloc_bytes; /* Bytes the same allocations would take from malloc. */
+} arena_t;
+
+/* Initialize an empty arena. */
+void arena_init(arena_t* arena);
+
+/* Allocate size bytes aligned for any pointer or integer, or return NULL. */
+void* arena_alloc(arena_t* arena, size_t size);
+
+/* Copy the len bytes at str, plus a terminator, into the arena. */
+char* arena_strndup(arena_t* arena, const char* str, size_t len);
+
+/* Free every block, leaving the arena empty. */
+void arena_destroy(arena_t* arena);
+
+#endif /* ARENA_H */
@@ -0,0 +1,83 @@
+#!/bin/bash
+#
+# Benchmarks words, lwords and pwords over copies of gutenberg/*.txt scaled
+# up BENCH_SCALES times, running the threaded programs with each of
+# BENCH_THREADS --threads. The list-backed programs take seconds per copy,
+# so they only run up to BENCH_LIST_MAX copies. Every output must match
+# the others at the same scale, ignoring order and spacing.
+#
+# Run through make bench, which builds the programs and sets the defaults.
+
+scales=${BENCH_SCALES:-1 10 100 1000}
+threads=${BENCH_THREADS:-1 2 4 8}
+list_max=${BENCH_LIST_MAX:-1}
+dir=bench
+mkdir -p $dir
+
+# Prints the path to the corpus repeated $1 times, creating it if needed.
+corpus() {
+  local file=$dir/corpus-$1x.txt
+  if [ ! -f $file ]; then
+    cat gutenberg/*.txt > $dir/corpus.tmp
+    for ((i = 0; i < $1; i++)); do
+      cat $dir/corpus.tmp
+    done > $file
+    rm $dir/corpus.tmp
+  fi
+  echo $file
+}
+
+failed=0
+
+# Runs PROGRAM with THREADS (or "-") on FILE and prints a row of the table.
+# BASE is the time of the one-thread run, for the speedup.
+run() {
+  local program=$1 nthreads=$2 file=$3 mb=$4
+  local args=($file)
+  [ $nthreads != - ] && args=(--threads $nthreads $file)
+  if ! ./measure ./$program "${args[@]}" > $dir/out 2> $dir/err; then
+    printf "%-12s %7s %6s  failed: %s\n" $program $nthreads ${scale}x "$(head -1 $dir/err)"
+    failed=1
+    return
+  fi
+  read seconds rss < <(tail -1 $dir/err)
+
+  local check=ok
+  awk '{ print $1, $2 }' $dir/out | sort > $dir/sorted
+  if [ ! -f $dir/expected ]; then
+    mv $dir/sorted $dir/expected
+  elif ! cmp -s $dir/sorted $dir/expected; then
+    check=DIFFERS
+    failed=1
+  fi
+
+  [ $nthreads = 1 ] && base=$seconds
+  awk -v p=$program -v n=$nthreads -v s=${scale}x -v mb=$mb -v t=$seconds -v rss=$rss \
+    -v base=${base:-0} -v check=$check 'BEGIN {
+      printf "%-12s %7s %6s %9.1f %9.3f %9.1f %8.1f %8s  %s\n", p, n, s, mb, t, mb / t, rss / 1024,
+        base ? sprintf("%.2f", base / t) : "-", check
+    }'
+}
+
+printf "%-12s %7s %6s %9s %9s %9s %8s %8s  %s\n" program threads scale MB seconds MB/s "RSS MB" \
+  speedup check
+for scale in $scales; do
+  file=$(corpus $scale)
+  mb=$(stat -c %s $file | awk '{ print $1 / 1e6 }')
+  rm -f $dir/expected
+  for program in pwords_hash lwords_hash pwords lwords words; do
+    base=
+    case $program in
+      pwords|lwords|words) [ $scale -le $list_max ] || continue ;;
+    esac
+    case $program in
+      pwords|pwords_hash)
+        for n in $threads; do
+          run $program $n $file $mb
+        done ;;
+      *) run $program - $file $mb ;;
+    esac
+  done
+done
+rm -f $dir/out $dir/err $dir/sorted $dir/expected
+exit $failed
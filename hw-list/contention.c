@@ -0,0 +1,127 @@
+/*
+ * Contention benchmark for a word count list shared by many threads.
+ *
+ * Every thread scans all of the input into the same list, so the work grows
+ * with the number of threads and the rate shows how well the list lets them
+ * count at once. It runs with 1, 2, 4, ... up to MAX_THREADS threads and
+ * checks each result against the counts of a single pass.
+ *
+ * Usage: contention MAX_THREADS FILE...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "word_count.h"
+#include "word_scan.h"
+
+#ifdef WORD_STRIPED
+#define VARIANT "striped"
+#elif defined(WORD_HASH)
+#define VARIANT "mutex"
+#else
+#define VARIANT "list"
+#endif
+
+typedef struct {
+  char* data;
+  size_t size;
+} input_t;
+
+typedef struct {
+  word_count_list_t* wclist;
+  input_t* inputs;
+  int num_inputs;
+} run_t;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void read_input(const char* filename, input_t* input) {
+  FILE* file = fopen(filename, "r");
+  if (file == NULL) {
+    perror(filename);
+    exit(1);
+  }
+  fseek(file, 0, SEEK_END);
+  input->size = ftell(file);
+  rewind(file);
+  input->data = malloc(input->size);
+  if (input->data == NULL || fread(input->data, 1, input->size, file) != input->size) {
+    perror(filename);
+    exit(1);
+  }
+  fclose(file);
+}
+
+static void* scan_all(void* arg) {
+  run_t* run = arg;
+  for (int i = 0; i < run->num_inputs; i++) {
+    if (!count_words_mem(run->wclist, run->inputs[i].data, run->inputs[i].size)) {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  }
+  return NULL;
+}
+
+/* Checks that WCLIST holds THREADS times the counts in ONCE for WORD. */
+static void check(word_count_list_t* wclist, word_count_list_t* once, char* word,
+                  int threads) {
+  word_count_t* expected = find_word(once, word);
+  word_count_t* actual = find_word(wclist, word);
+  int want = expected ? expected->count * threads : 0;
+  int got = actual ? actual->count : 0;
+  if (len_words(wclist) != len_words(once) || got != want) {
+    fprintf(stderr, "%d threads: %zu words, \"%s\" x %d; expected %zu words, x %d\n", threads,
+            len_words(wclist), word, got, len_words(once), want);
+    exit(1);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  int max_threads = argc > 2 ? atoi(argv[1]) : 0;
+  if (max_threads <= 0) {
+    fprintf(stderr, "Usage: %s MAX_THREADS FILE...\n", argv[0]);
+    return 1;
+  }
+
+  int num_inputs = argc - 2;
+  input_t* inputs = malloc(num_inputs * sizeof(input_t));
+  size_t bytes = 0;
+  for (int i = 0; i < num_inputs; i++) {
+    read_input(argv[i + 2], &inputs[i]);
+    bytes += inputs[i].size;
+  }
+
+  word_count_list_t once;
+  init_words(&once);
+  run_t single = {&once, inputs, num_inputs};
+  scan_all(&single);
+
+  pthread_t* threads = malloc(max_threads * sizeof(pthread_t));
+  for (int n = 1; n <= max_threads; n *= 2) {
+    word_count_list_t* wclist = malloc(sizeof(word_count_list_t));
+    init_words(wclist);
+    run_t run = {wclist, inputs, num_inputs};
+
+    double start = now();
+    for (int i = 0; i < n; i++)
+      pthread_create(&threads[i], NULL, scan_all, &run);
+    for (int i = 0; i < n; i++)
+      pthread_join(threads[i], NULL);
+    double elapsed = now() - start;
+
+    check(wclist, &once, "the", n);
+    printf("%-8s %2d threads: %7.1f MB/s\n", VARIANT, n, n * bytes / elapsed / 1e6);
+    destroy_words(wclist);
+    free(wclist);
+  }
+  return 0;
+}
@@ -1,6 +1,21 @@
 /*
  * Word count application with one thread per input file.
  *
+ * With --threads N, the inputs are instead split into chunks that end on
+ * word boundaries, and a pool of N threads counts the chunks, so a single
+ * large file or stdin still uses every core. With --top N, only the N most
+ * frequent words are printed. --memory reports the list's memory use on
+ * stderr.
+ *
+ * With --stream, pwords reads stdin until it ends and prints the --top words
+ * so far (10 by default) every --interval seconds and every --every MB of
+ * input, without pausing the read. --max-words N keeps at most about N words
+ * exact and estimates the rest in a fixed-size sketch; it also takes an
+ * extra snapshot whenever more than N new words arrive between snapshots.
+ *
+ * --save FILE writes the counts to a binary index instead of printing them;
+ * wcindex combines and prints saved indexes.
+ *
  * You may modify this file in any way you like, and are expected to modify it.
  * Your solution must read each input file from a separate thread. We encourage
  * you to make as few changes as necessary.
@@ -28,9 +43,81 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "word_count.h"
 #include "word_helpers.h"
+#include "stream.h"
+#include "word_index.h"
+#include "word_scan.h"
+#include "word_top.h"
+
+/* Bytes per chunk with --threads; many chunks per thread keep them all busy. */
+#define CHUNK_SIZE (1 << 20)
+
+// a regular file mapped into memory
+typedef struct {
+  char* data;
+  size_t size;
+} input_t;
+
+// opens FILENAME, or returns stdin if NULL
+static int open_file(const char* filename) {
+  int fd = filename ? open(filename, O_RDONLY) : STDIN_FILENO;
+  if (fd < 0) {
+    printf("ERROR; could not open file %s\n", filename);
+    exit(-1);
+  }
+  return fd;
+}
+
+// maps FD into INPUT if it is a non-empty regular file
+static bool map_input(int fd, input_t* input) {
+  struct stat st;
+  input->data = NULL;
+  input->size = 0;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    return false;
+  input->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (input->data == MAP_FAILED) {
+    input->data = NULL;
+    return false;
+  }
+  madvise(input->data, st.st_size, MADV_SEQUENTIAL);
+  input->size = st.st_size;
+  return true;
+}
+
+// unmaps INPUT's data, if it was mapped
+static void free_input(input_t* input) {
+  if (input->data != NULL)
+    munmap(input->data, input->size);
+}
+
+// counts FILENAME, or stdin if NULL, into WCLIST: mapped if it is a regular
+// file, and otherwise read and scanned a block at a time
+static void count_input(word_count_list_t* wclist, const char* filename) {
+  int fd = open_file(filename);
+  input_t input;
+  bool ok;
+  if (map_input(fd, &input)) {
+    ok = count_words_mem(wclist, input.data, input.size);
+    free_input(&input);
+  } else {
+    ok = count_words_fd(wclist, fd);
+  }
+  if (filename)
+    close(fd);
+  if (!ok) {
+    printf("ERROR; could not count %s\n", filename ? filename : "stdin");
+    exit(-1);
+  }
+}
+
 // struct to hold arguments for each thread
 typedef struct {
   char* filename;
@@ -38,30 +125,287 @@ typedef struct {
 } threads_args_t;
 
 // thread function that processes a file
+// Counts into a table of its own, so the threads only share the lock on the
+// result once, to merge their counts into it.
 void* process_file(void* args) {
   threads_args_t* data = (threads_args_t*) args;
-  FILE* file = fopen(data->filename, "r");
-  if (file == NULL) {
-    printf("ERROR; could not open file %s\n", data->filename);
+  word_count_list_t local_counts;
+  init_words(&local_counts);
+  count_input(&local_counts, data->filename);
+  if (!merge_words(data->wclist, &local_counts)) {
+    printf("ERROR; out of memory counting %s\n", data->filename);
     exit(-1);
   }
-  count_words(data->wclist, file);
-  fclose(file);
   pthread_exit(NULL);//what is this?
 }
 
 
+// a byte range of an input that starts and ends between words
+typedef struct {
+  const char* start;
+  size_t size;
+  char* owned; // buffer to free once counted, for inputs read in pieces
+} chunk_t;
+
+// chunks shared by the --threads pool, handed out in order as they are added
+typedef struct {
+  chunk_t* chunks;
+  size_t num_chunks;
+  size_t capacity;
+  size_t next_chunk;
+  size_t buffered;     // owned chunks not yet counted
+  size_t max_buffered; // bound on buffered, so a stream is not read far ahead
+  bool done;           // no more chunks will be added
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  word_count_list_t* wclist;
+} pool_t;
+
+// appends a chunk to POOL, first waiting for room if it owns its buffer
+static void add_chunk(pool_t* pool, const char* start, size_t size, char* owned) {
+  pthread_mutex_lock(&pool->lock);
+  while (owned != NULL && pool->buffered >= pool->max_buffered)
+    pthread_cond_wait(&pool->changed, &pool->lock);
+  if (pool->num_chunks == pool->capacity && pool->next_chunk > 0) {
+    // drop the chunks already handed out
+    pool->num_chunks -= pool->next_chunk;
+    memmove(pool->chunks, pool->chunks + pool->next_chunk, pool->num_chunks * sizeof(chunk_t));
+    pool->next_chunk = 0;
+  }
+  if (pool->num_chunks == pool->capacity) {
+    pool->capacity = pool->capacity ? pool->capacity * 2 : 64;
+    pool->chunks = realloc(pool->chunks, pool->capacity * sizeof(chunk_t));
+    if (pool->chunks == NULL) {
+      printf("ERROR; out of memory\n");
+      exit(-1);
+    }
+  }
+  pool->chunks[pool->num_chunks++] = (chunk_t){start, size, owned};
+  if (owned != NULL)
+    pool->buffered++;
+  pthread_cond_broadcast(&pool->changed);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+// moves OFFSET past any word it falls inside of
+static size_t align_to_word(const input_t* input, size_t offset) {
+  while (offset < input->size && isalpha((unsigned char)input->data[offset]))
+    offset++;
+  return offset;
+}
+
+// adds INPUT's chunks to POOL
+static void split_input(const input_t* input, pool_t* pool) {
+  size_t start = 0;
+  while (start < input->size) {
+    size_t end = input->size;
+    if (input->size - start > CHUNK_SIZE)
+      end = align_to_word(input, start + CHUNK_SIZE);
+    add_chunk(pool, input->data + start, end - start, NULL);
+    start = end;
+  }
+}
+
+// reads FD into chunks of CHUNK_SIZE and adds each to POOL as soon as it is
+// full; a word cut off at the end of one chunk is carried over to the next
+static void split_stream(int fd, const char* name, pool_t* pool) {
+  size_t capacity = CHUNK_SIZE;
+  size_t len = 0;
+  char* buf = malloc(capacity);
+  for (;;) {
+    if (buf == NULL) {
+      printf("ERROR; out of memory reading %s\n", name);
+      exit(-1);
+    }
+    ssize_t n = read(fd, buf + len, capacity - len);
+    if (n < 0) {
+      printf("ERROR; could not read %s\n", name);
+      exit(-1);
+    }
+    if (n == 0)
+      break;
+    len += n;
+    if (len < capacity)
+      continue;
+
+    size_t end = complete_words(buf, len);
+    if (end == 0) {
+      // one word fills the chunk
+      capacity *= 2;
+      buf = realloc(buf, capacity);
+      continue;
+    }
+    size_t carry = len - end;
+    capacity = CHUNK_SIZE;
+    while (capacity <= carry)
+      capacity *= 2;
+    char* next = malloc(capacity);
+    if (next != NULL)
+      memcpy(next, buf + end, carry);
+    add_chunk(pool, buf, end, buf);
+    buf = next;
+    len = carry;
+  }
+  if (len > 0)
+    add_chunk(pool, buf, len, buf);
+  else
+    free(buf);
+}
+
+// pool thread: counts chunks into a private table until none are left
+static void* count_chunks(void* args) {
+  pool_t* pool = (pool_t*) args;
+  word_count_list_t local_counts;
+  init_words(&local_counts);
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->next_chunk == pool->num_chunks && !pool->done)
+      pthread_cond_wait(&pool->changed, &pool->lock);
+    if (pool->next_chunk == pool->num_chunks) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    chunk_t chunk = pool->chunks[pool->next_chunk++];
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!count_words_mem(&local_counts, chunk.start, chunk.size)) {
+      printf("ERROR; out of memory\n");
+      exit(-1);
+    }
+    if (chunk.owned != NULL) {
+      free(chunk.owned);
+      pthread_mutex_lock(&pool->lock);
+      pool->buffered--;
+      pthread_cond_broadcast(&pool->changed);
+      pthread_mutex_unlock(&pool->lock);
+    }
+  }
+
+  if (!merge_words(pool->wclist, &local_counts)) {
+    printf("ERROR; out of memory\n");
+    exit(-1);
+  }
+  return NULL;
+}
+
+// counts the NUM_FILES FILENAMES, or stdin if there are none, on NUM_THREADS
+// threads; mapped files are split up front, and other inputs as they are read
+static void count_chunked(word_count_list_t* wclist, char** filenames, int num_files,
+                          int num_threads) {
+  int num_inputs = num_files > 0 ? num_files : 1;
+  input_t* inputs = malloc(num_inputs * sizeof(input_t));
+  pool_t pool = {NULL, 0, 0, 0, 0, 2 * (size_t)num_threads, false,
+                 PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, wclist};
+
+  pthread_t* threads = malloc(num_threads * sizeof(pthread_t));
+  for (int i = 0; i < num_threads; i++) {
+    int rc = pthread_create(&threads[i], NULL, count_chunks, &pool);
+    if (rc) {
+      printf("ERROR; return code from pthread_create() is %d\n", rc);
+      exit(-1);
+    }
+  }
+
+  for (int i = 0; i < num_inputs; i++) {
+    const char* filename = num_files > 0 ? filenames[i] : NULL;
+    int fd = open_file(filename);
+    if (map_input(fd, &inputs[i]))
+      split_input(&inputs[i], &pool);
+    else
+      split_stream(fd, filename ? filename : "stdin", &pool);
+    if (filename)
+      close(fd);
+  }
+  pthread_mutex_lock(&pool.lock);
+  pool.done = true;
+  pthread_cond_broadcast(&pool.changed);
+  pthread_mutex_unlock(&pool.lock);
+
+  for (int i = 0; i < num_threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  for (int i = 0; i < num_inputs; i++) {
+    free_input(&inputs[i]);
+  }
+  free(inputs);
+  free(pool.chunks);
+  free(threads);
+}
+
 /*
- * main - handle command line, spawning one thread per file.
+ * main - handle command line, spawning one thread per file, or a pool of
+ * --threads threads over chunks of the files.
  */
 int main(int argc, char* argv[]) {
+  static struct option long_options[] = {
+    {"threads", required_argument, NULL, 't'},
+    {"top", required_argument, NULL, 'k'},
+    {"memory", no_argument, NULL, 'm'},
+    {"stream", no_argument, NULL, 's'},
+    {"interval", required_argument, NULL, 'i'},
+    {"every", required_argument, NULL, 'e'},
+    {"max-words", required_argument, NULL, 'w'},
+    {"save", required_argument, NULL, 'o'},
+    {NULL, 0, NULL, 0},
+  };
+  int pool_threads = 0;
+  int top = 0;
+  bool memory = false;
+  bool stream = false;
+  double interval = 0;
+  int every = 0;
+  int max_words = 0;
+  char* save = NULL;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "t:k:msi:e:w:o:", long_options, NULL)) != -1) {
+    if (opt == 'm') {
+      memory = true;
+      continue;
+    }
+    if (opt == 's') {
+      stream = true;
+      continue;
+    }
+    if (opt == 'i' && (interval = atof(optarg)) > 0) {
+      continue;
+    }
+    if (opt == 'o') {
+      save = optarg;
+      continue;
+    }
+    int* value = opt == 't' ? &pool_threads : opt == 'k' ? &top : opt == 'e' ? &every
+                 : opt == 'w' ? &max_words : NULL;
+    if (value == NULL || (*value = atoi(optarg)) <= 0) {
+      fprintf(stderr,
+              "Usage: %s [--threads N] [--top N | --save INDEX] [--memory] [FILE...]\n"
+              "       %s --stream [--top N] [--interval S] [--every MB] [--max-words N]\n",
+              argv[0], argv[0]);
+      return 1;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+
+  if (stream) {
+    stream_options_t options = {top > 0 ? top : 10, interval, (size_t)every << 20, max_words};
+    if (!stream_words(STDIN_FILENO, &options, stdout)) {
+      printf("ERROR; reading stdin\n");
+      exit(-1);
+    }
+    return 0;
+  }
+
   /* Create the empty data structure. */
   word_count_list_t word_counts;
   init_words(&word_counts);
 
-  if (argc <= 1) {
+  if (pool_threads > 0) {
+    count_chunked(&word_counts, argv + 1, argc - 1, pool_threads);
+  } else if (argc <= 1) {
     /* Process stdin in a single thread. */
-    count_words(&word_counts, stdin);
+    count_input(&word_counts, NULL);
   } else {
     /* TODO */
     int num_threads = argc - 1;
@@ -91,7 +435,23 @@ int main(int argc, char* argv[]) {
   }
 
   /* Output final result of all threads' work. */
-  wordcount_sort(&word_counts, less_count);
-  fprint_words(&word_counts, stdout);
+  if (memory) {
+    fprint_memory_usage(&word_counts, stderr);
+  }
+  if (save != NULL) {
+    if (!save_index(&word_counts, save)) {
+      perror(save);
+      exit(-1);
+    }
+  } else if (top > 0) {
+    if (!fprint_top_words(&word_counts, top, less_count, stdout)) {
+      printf("ERROR; out of memory\n");
+      exit(-1);
+    }
+  } else {
+    wordcount_sort(&word_counts, less_count);
+    fprint_words(&word_counts, stdout);
+  }
+  destroy_words(&word_counts);
   return 0;
 }
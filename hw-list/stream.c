@@ -0,0 +1,337 @@
+/*
+ * Implementation of the stream interface.
+ *
+ * The reading thread counts into a small delta table. When a snapshot is
+ * due it hands the delta to a reporter thread and carries on with a spare
+ * table, so reading never waits for a report; if the reporter is still busy
+ * with the previous delta, the reader keeps counting into the current one
+ * and tries again later. The reporter merges each delta into the running
+ * totals and prints the top words from them.
+ *
+ * With max_words set, the totals stop taking new words once they hold that
+ * many. Later newcomers are counted in a count-min sketch instead. One whose
+ * estimate climbs past the smallest count in the last snapshot by more than
+ * the sketch's error bound is promoted into the totals with that estimate,
+ * and the word with the least count in the totals goes back to the sketch
+ * to make room. So heavy hitters that show up late still reach the report,
+ * while the long tail costs a fixed amount of memory. Snapshots mark counts
+ * that started from an estimate with a leading '~'. The delta is bounded the same way: once it holds more than
+ * max_words distinct words, the reader hands it off at once, waiting for the
+ * reporter if it must, so a burst of new words between snapshots cannot grow
+ * it without limit.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stream.h"
+#include "word_helpers.h"
+#include "word_scan.h"
+#include "word_top.h"
+
+#define READ_SIZE (64 * 1024)
+
+#define SKETCH_DEPTH 4
+#define SKETCH_WIDTH (1 << 16)
+
+/* Count-min sketch: each row over-counts a word by its collisions. */
+typedef struct sketch {
+  uint32_t counts[SKETCH_DEPTH][SKETCH_WIDTH];
+  size_t total; /* Occurrences added. */
+} sketch_t;
+
+typedef struct stream {
+  const stream_options_t* options;
+  FILE* outfile;
+
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  word_count_list_t* handed; /* Delta waiting for the reporter. */
+  word_count_list_t* spare;  /* Emptied delta for the reader to take. */
+  size_t handed_bytes;
+  bool done;
+  bool failed;
+
+  /* Only the reporter touches these. */
+  word_count_list_t totals;
+  word_count_list_t estimated; /* Words in totals whose count began as an estimate. */
+  sketch_t* sketch;
+  int threshold; /* Smallest count in the last snapshot. */
+  size_t words;
+  size_t bytes;
+  int snapshots;
+} stream_t;
+
+/* 32-bit FNV-1a of WORD, starting from SEED. */
+static uint32_t hash_seeded(const char* word, uint32_t seed) {
+  uint32_t hash = seed;
+  for (const unsigned char* c = (const unsigned char*)word; *c != '\0'; c++)
+    hash = (hash ^ *c) * 16777619u;
+  return hash;
+}
+
+/* Adds COUNT occurrences of WORD and returns its new estimate. */
+static uint32_t sketch_add(sketch_t* sketch, const char* word, uint32_t count) {
+  uint32_t estimate = UINT32_MAX;
+  for (int row = 0; row < SKETCH_DEPTH; row++) {
+    uint32_t* counter = &sketch->counts[row][hash_seeded(word, 2166136261u + row) % SKETCH_WIDTH];
+    *counter += count;
+    if (*counter < estimate)
+      estimate = *counter;
+  }
+  sketch->total += count;
+  return estimate;
+}
+
+static void find_least(word_count_t* wc, void* aux) {
+  word_count_t** least = aux;
+  if (*least == NULL || less_count(wc, *least))
+    *least = wc;
+}
+
+/* Moves the word with the least count in the totals back into the sketch. */
+static void evict_least(stream_t* stream) {
+  word_count_t* least = NULL;
+  for_each_word(&stream->totals, find_least, &least);
+  if (least == NULL)
+    return;
+  remove_word(&stream->estimated, least->word);
+  sketch_add(stream->sketch, least->word, least->count);
+  remove_word(&stream->totals, least->word);
+}
+
+/* Adds one entry of a delta to the totals. */
+static void merge_entry(word_count_t* wc, void* aux) {
+  stream_t* stream = aux;
+  stream->words += wc->count;
+
+  word_count_t* total = find_word(&stream->totals, wc->word);
+  if (total != NULL) {
+    total->count += wc->count;
+    return;
+  }
+
+  int count = wc->count;
+  bool estimated = false;
+  size_t max_words = stream->options->max_words;
+  if (max_words > 0 && len_words(&stream->totals) >= max_words) {
+    if (stream->sketch == NULL && (stream->sketch = calloc(1, sizeof(sketch_t))) == NULL) {
+      stream->failed = true;
+      return;
+    }
+    uint32_t estimate = sketch_add(stream->sketch, wc->word, count);
+    /* Collisions add at most e * total / SKETCH_WIDTH, for all but a tiny share of words. */
+    uint64_t error = (stream->sketch->total * 3 + SKETCH_WIDTH - 1) / SKETCH_WIDTH;
+    if (stream->threshold == 0 || estimate <= (uint64_t)stream->threshold + error)
+      return;
+    evict_least(stream);
+    count = estimate;
+    estimated = true;
+  }
+
+  total = add_word_span(&stream->totals, wc->word, strlen(wc->word));
+  if (total == NULL ||
+      (estimated && add_word_span(&stream->estimated, wc->word, strlen(wc->word)) == NULL))
+    stream->failed = true;
+  else
+    total->count += count - 1;
+}
+
+/*
+ * Adds DELTA to the totals. Under max_words the heaviest words go first, so
+ * the ones that fill the totals are the ones worth counting exactly.
+ */
+static void merge_delta(stream_t* stream, word_count_list_t* delta) {
+  if (stream->options->max_words == 0) {
+    for_each_word(delta, merge_entry, stream);
+    return;
+  }
+  size_t len = len_words(delta);
+  word_count_t** order = malloc(len * sizeof(word_count_t*));
+  if (order == NULL && len > 0) {
+    stream->failed = true;
+    return;
+  }
+  size_t n = top_words(delta, len, less_count, order);
+  while (n > 0)
+    merge_entry(order[--n], stream);
+  free(order);
+}
+
+static void print_snapshot(stream_t* stream) {
+  size_t k = stream->options->top;
+  word_count_t** top = malloc(k * sizeof(word_count_t*));
+  if (top == NULL && k > 0) {
+    stream->failed = true;
+    return;
+  }
+  size_t n = top_words(&stream->totals, k, less_count, top);
+
+  fprintf(stream->outfile, "# snapshot %d: %zu bytes, %zu words, %zu distinct", ++stream->snapshots,
+          stream->bytes, stream->words, len_words(&stream->totals));
+  if (stream->sketch != NULL)
+    fprintf(stream->outfile, ", %zu in sketch", stream->sketch->total);
+  fprintf(stream->outfile, "\n");
+  for (size_t i = 0; i < n; i++) {
+    bool estimated = find_word(&stream->estimated, top[i]->word) != NULL;
+    fprintf(stream->outfile, "%s%i\t%s\n", estimated ? "~" : "", top[i]->count, top[i]->word);
+  }
+  fflush(stream->outfile);
+
+  if (n == k && n > 0)
+    stream->threshold = top[0]->count;
+  free(top);
+}
+
+static void* report(void* arg) {
+  stream_t* stream = arg;
+  pthread_mutex_lock(&stream->lock);
+  for (;;) {
+    while (stream->handed == NULL && !stream->done)
+      pthread_cond_wait(&stream->changed, &stream->lock);
+    if (stream->handed == NULL)
+      break;
+    word_count_list_t* delta = stream->handed;
+    stream->bytes += stream->handed_bytes;
+    pthread_mutex_unlock(&stream->lock);
+
+    merge_delta(stream, delta);
+    destroy_words(delta);
+    init_words(delta);
+    print_snapshot(stream);
+
+    pthread_mutex_lock(&stream->lock);
+    stream->handed = NULL;
+    stream->spare = delta;
+    pthread_cond_broadcast(&stream->changed);
+  }
+  pthread_mutex_unlock(&stream->lock);
+  return NULL;
+}
+
+/*
+ * Hands *DELTA, holding BYTES of input, to the reporter and replaces it with
+ * the spare table. Returns false, leaving *DELTA alone, if the reporter is
+ * busy, unless WAIT.
+ */
+static bool hand_off(stream_t* stream, word_count_list_t** delta, size_t bytes, bool wait) {
+  pthread_mutex_lock(&stream->lock);
+  while (wait && stream->spare == NULL)
+    pthread_cond_wait(&stream->changed, &stream->lock);
+  bool handed = stream->spare != NULL;
+  if (handed) {
+    stream->handed = *delta;
+    stream->handed_bytes = bytes;
+    *delta = stream->spare;
+    stream->spare = NULL;
+    pthread_cond_broadcast(&stream->changed);
+  }
+  pthread_mutex_unlock(&stream->lock);
+  return handed;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+bool stream_words(int fd, const stream_options_t* options, FILE* outfile) {
+  stream_t stream = {options, outfile, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+  word_count_list_t* tables = malloc(2 * sizeof(word_count_list_t));
+  size_t capacity = READ_SIZE;
+  char* buf = malloc(capacity);
+  if (tables == NULL || buf == NULL) {
+    free(tables);
+    free(buf);
+    return false;
+  }
+  word_count_list_t* delta = &tables[0];
+  init_words(delta);
+  init_words(&tables[1]);
+  stream.spare = &tables[1];
+  init_words(&stream.totals);
+  init_words(&stream.estimated);
+
+  pthread_t reporter;
+  pthread_create(&reporter, NULL, report, &stream);
+
+  size_t pending = 0; /* Bytes of a word cut off by the last read. */
+  size_t unreported = 0;
+  double last = now();
+  bool ok = true;
+  for (;;) {
+    /* Wake up for a timed snapshot even when no input arrives. */
+    int timeout = -1;
+    if (options->interval > 0) {
+      double left = last + options->interval - now();
+      timeout = left > 0 ? (int)(left * 1000) + 1 : 0;
+    }
+    struct pollfd pfd = {fd, POLLIN, 0};
+    int ready = poll(&pfd, 1, timeout);
+    if (ready < 0 && errno != EINTR) {
+      ok = false;
+      break;
+    }
+
+    if (ready > 0) {
+      if (pending == capacity) {
+        char* grown = realloc(buf, capacity * 2);
+        if (grown == NULL) {
+          ok = false;
+          break;
+        }
+        buf = grown;
+        capacity *= 2;
+      }
+      ssize_t n = read(fd, buf + pending, capacity - pending);
+      if (n < 0 && errno != EINTR) {
+        ok = false;
+        break;
+      }
+      if (n == 0)
+        break;
+      if (n > 0) {
+        size_t len = pending + n;
+        size_t end = complete_words(buf, len);
+        if (!count_words_mem(delta, buf, end)) {
+          ok = false;
+          break;
+        }
+        memmove(buf, buf + end, len - end);
+        pending = len - end;
+        unreported += n;
+      }
+    }
+
+    bool full = options->max_words > 0 && len_words(delta) > options->max_words;
+    bool due = full || (options->bytes > 0 && unreported >= options->bytes) ||
+               (options->interval > 0 && now() - last >= options->interval);
+    if (due && hand_off(&stream, &delta, unreported, full)) {
+      unreported = 0;
+      last = now();
+    }
+  }
+
+  if (ok && !count_words_mem(delta, buf, pending))
+    ok = false;
+  hand_off(&stream, &delta, unreported, true);
+  pthread_mutex_lock(&stream.lock);
+  stream.done = true;
+  pthread_cond_broadcast(&stream.changed);
+  pthread_mutex_unlock(&stream.lock);
+  pthread_join(reporter, NULL);
+
+  destroy_words(&tables[0]);
+  destroy_words(&tables[1]);
+  destroy_words(&stream.totals);
+  destroy_words(&stream.estimated);
+  free(stream.sketch);
+  free(tables);
+  free(buf);
+  return ok && !stream.failed;
+}
@@ -0,0 +1,26 @@
+/*
+ * The stream interface counts the words of an input that may never end,
+ * such as a live log, and prints the most frequent words so far at regular
+ * intervals while it keeps reading.
+ */
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "word_count.h"
+
+typedef struct stream_options {
+  size_t top;       /* Words in each snapshot. */
+  double interval;  /* Seconds between snapshots, or 0. */
+  size_t bytes;     /* Bytes read between snapshots, or 0. */
+  size_t max_words; /* Distinct words counted exactly, or 0 for no limit. */
+} stream_options_t;
+
+/*
+ * Counts the words read from fd until end of file, printing a snapshot to
+ * outfile whenever options->interval or options->bytes has passed, and a
+ * last one at the end. Returns false on a read error or out of memory.
+ */
+bool stream_words(int fd, const stream_options_t* options, FILE* outfile);
+
+#endif /* STREAM_H */
@@ -0,0 +1,68 @@
+/*
+ * Combines word count indexes saved by pwords --save.
+ *
+ * With -o OUT, the indexes are merged into one new index, so daily counts
+ * can be rolled up into weekly ones without counting the text again.
+ * Otherwise the combined counts are printed as pwords would print them.
+ *
+ * Usage: wcindex [-o OUT | --top N] INDEX...
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "word_count.h"
+#include "word_helpers.h"
+#include "word_index.h"
+#include "word_top.h"
+
+int main(int argc, char* argv[]) {
+  static struct option long_options[] = {
+    {"output", required_argument, NULL, 'o'},
+    {"top", required_argument, NULL, 'k'},
+    {NULL, 0, NULL, 0},
+  };
+  char* out = NULL;
+  int top = 0;
+  bool usage = false;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "o:k:", long_options, NULL)) != -1) {
+    if (opt == 'o')
+      out = optarg;
+    else if (opt != 'k' || (top = atoi(optarg)) <= 0)
+      usage = true;
+  }
+  if (usage || optind == argc || (out != NULL && top > 0)) {
+    fprintf(stderr, "Usage: %s [-o OUT | --top N] INDEX...\n", argv[0]);
+    return 1;
+  }
+  char** paths = argv + optind;
+  int n = argc - optind;
+
+  if (out != NULL) {
+    if (!merge_index_files(paths, n, out)) {
+      perror("wcindex");
+      return 1;
+    }
+    return 0;
+  }
+
+  word_count_list_t word_counts;
+  init_words(&word_counts);
+  if (!load_indexes(&word_counts, paths, n)) {
+    perror("wcindex");
+    return 1;
+  }
+  if (top > 0) {
+    if (!fprint_top_words(&word_counts, top, less_count, stdout)) {
+      fprintf(stderr, "wcindex: out of memory\n");
+      return 1;
+    }
+  } else {
+    wordcount_sort(&word_counts, less_count);
+    fprint_words(&word_counts, stdout);
+  }
+  destroy_words(&word_counts);
+  return 0;
+}
@@ -0,0 +1,544 @@
+/*
+ * Implementation of the word_count interface using an open-addressing hash
+ * table, with or without pthreads, and optionally striped.
+ *
+ * Entries live in the table itself and are found by linear probing. Each
+ * entry caches the hash of its word, so most mismatches cost one integer
+ * compare, and short words are copied into the entry, so a lookup usually
+ * touches a single cache line. wordcount_sort() builds an array of entries
+ * in sorted order, which fprint_words() follows until the table changes.
+ *
+ * With WORD_STRIPED the top bits of the hash pick one of WORD_STRIPES
+ * tables, each behind its own reader-writer lock. Words already present are
+ * counted under the read lock with an atomic increment, so threads only
+ * exclude each other when they add new words to the same stripe.
+ */
+
+#ifndef WORD_HASH
+#error "WORD_HASH must be #define'd when compiling word_count_h.c"
+#endif
+
+#if defined(WORD_STRIPED) && !defined(PTHREADS)
+#error "WORD_STRIPED needs PTHREADS"
+#endif
+
+#include "word_count.h"
+
+#define INITIAL_CAPACITY 1024
+
+#ifdef WORD_STRIPED
+#define NUM_TABLES WORD_STRIPES
+#define TABLE(wclist, i) (&(wclist)->stripes[i].table)
+#define STRIPE(wclist, hash) (&(wclist)->stripes[(uint64_t)(hash) * WORD_STRIPES >> 32])
+#else
+#define NUM_TABLES 1
+#define TABLE(wclist, i) (&(wclist)->table)
+#endif
+
+#if defined(PTHREADS) && !defined(WORD_STRIPED)
+#define LOCK(wclist) pthread_mutex_lock(&(wclist)->lock)
+#define UNLOCK(wclist) pthread_mutex_unlock(&(wclist)->lock)
+#else
+#define LOCK(wclist)
+#define UNLOCK(wclist)
+#endif
+
+/* 32-bit FNV-1a of the LEN bytes at WORD. */
+static uint32_t hash_word(const char* word, size_t len) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+    hash = (hash ^ (unsigned char)word[i]) * 16777619u;
+  return hash;
+}
+
+/*
+ * Returns the slot holding the LEN bytes at WORD, or the empty slot where they
+ * belong. The table must have at least one empty slot.
+ */
+static word_count_t* probe(word_table_t* table, const char* word, size_t len, uint32_t hash) {
+  size_t mask = table->capacity - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    word_count_t* wc = &table->slots[i];
+    if (wc->word == NULL ||
+        (wc->hash == hash && strncmp(wc->word, word, len) == 0 && wc->word[len] == '\0'))
+      return wc;
+  }
+}
+
+/* Returns the entry for the LEN bytes at WORD, or NULL if there is none. */
+static word_count_t* lookup(word_table_t* table, const char* word, size_t len, uint32_t hash) {
+  if (table->capacity == 0)
+    return NULL;
+  word_count_t* wc = probe(table, word, len, hash);
+  return wc->word != NULL ? wc : NULL;
+}
+
+/* Doubles the number of slots. Returns false if out of memory. */
+static bool grow(word_table_t* table) {
+  size_t capacity = table->capacity ? table->capacity * 2 : INITIAL_CAPACITY;
+  word_count_t* slots = calloc(capacity, sizeof(word_count_t));
+  if (slots == NULL)
+    return false;
+
+  for (size_t i = 0; i < table->capacity; i++) {
+    word_count_t* old = &table->slots[i];
+    if (old->word == NULL)
+      continue;
+    size_t j = old->hash & (capacity - 1);
+    while (slots[j].word != NULL)
+      j = (j + 1) & (capacity - 1);
+    word_count_t* wc = &slots[j];
+    *wc = *old;
+    if (old->word == old->key)
+      wc->word = wc->key;
+  }
+  free(table->slots);
+  table->slots = slots;
+  table->capacity = capacity;
+  return true;
+}
+
+/*
+ * Returns the slot holding the LEN bytes at WORD, which hash to HASH, or an
+ * empty slot for them, growing the table as needed. Returns NULL if out of
+ * memory.
+ */
+static word_count_t* claim_slot(word_table_t* table, const char* word, size_t len,
+                                uint32_t hash) {
+  /* Keep the load factor at or below 3/4. */
+  if ((table->size + 1) * 4 > table->capacity * 3 && !grow(table))
+    return NULL;
+  return probe(table, word, len, hash);
+}
+
+/* Drops the order set by wordcount_sort(). Stripes may race to do this. */
+static void forget_order(word_count_list_t* wclist) {
+  free(__atomic_exchange_n(&wclist->sorted, NULL, __ATOMIC_ACQ_REL));
+}
+
+/*
+ * Counts the LEN bytes at WORD in TABLE. OWNED is the same word as a string to
+ * keep or free, or NULL to copy WORD if it is new. Returns NULL if out of
+ * memory, leaving OWNED to the caller.
+ */
+static word_count_t* count_word(word_count_list_t* wclist, word_table_t* table,
+                                const char* word, size_t len, uint32_t hash, char* owned) {
+  word_count_t* wc = claim_slot(table, word, len, hash);
+  if (wc == NULL)
+    return NULL;
+
+  if (wc->word != NULL) {
+    __atomic_add_fetch(&wc->count, 1, __ATOMIC_RELAXED);
+    free(owned);
+    return wc;
+  }
+
+  if (len < WORD_INLINE_SIZE) {
+    memcpy(wc->key, word, len);
+    wc->key[len] = '\0';
+    wc->word = wc->key;
+    free(owned);
+  } else {
+    if (owned == NULL && (owned = strndup(word, len)) == NULL)
+      return NULL;
+    wc->word = owned;
+  }
+  wc->count = 1;
+  wc->hash = hash;
+  table->size++;
+  forget_order(wclist);
+  return wc;
+}
+
+/*
+ * Moves FROM into TABLE, adding its count to an entry for the same word.
+ * Returns false if out of memory.
+ */
+static bool move_entry(word_table_t* table, word_count_t* from) {
+  word_count_t* wc = claim_slot(table, from->word, strlen(from->word), from->hash);
+  if (wc == NULL)
+    return false;
+
+  if (wc->word != NULL) {
+    wc->count += from->count;
+    if (from->word != from->key)
+      free(from->word);
+  } else {
+    *wc = *from;
+    if (from->word == from->key)
+      wc->word = wc->key;
+    table->size++;
+  }
+  from->word = NULL;
+  return true;
+}
+
+/*
+ * Shifts the entries after the emptied slot HOLE back into the gap, as far
+ * as their probe runs allow, so that every entry can still be found.
+ */
+static void close_gap(word_table_t* table, size_t hole) {
+  size_t mask = table->capacity - 1;
+  for (size_t j = (hole + 1) & mask; table->slots[j].word != NULL; j = (j + 1) & mask) {
+    word_count_t* wc = &table->slots[j];
+    /* An entry whose home lies after the hole, up to J, must stay put. */
+    if (((j - (wc->hash & mask)) & mask) < ((j - hole) & mask))
+      continue;
+    table->slots[hole] = *wc;
+    if (wc->word == wc->key)
+      table->slots[hole].word = table->slots[hole].key;
+    wc->word = NULL;
+    hole = j;
+  }
+}
+
+/*
+ * Moves slot I of FROM into TO, closing the gap it leaves, so that the
+ * entries left in FROM can still be found. Slot I may hold one of them
+ * afterwards. Returns false if out of memory, leaving FROM as it was.
+ */
+static bool take_entry(word_table_t* to, word_table_t* from, size_t i) {
+  if (!move_entry(to, &from->slots[i]))
+    return false;
+  from->size--;
+  close_gap(from, i);
+  return true;
+}
+
+/* Removes the LEN bytes at WORD from TABLE. Returns false if they are not there. */
+static bool remove_entry(word_count_list_t* wclist, word_table_t* table, const char* word,
+                         size_t len, uint32_t hash) {
+  word_count_t* wc = lookup(table, word, len, hash);
+  if (wc == NULL)
+    return false;
+  forget_order(wclist);
+  if (wc->word != wc->key)
+    free(wc->word);
+  wc->word = NULL;
+  table->size--;
+  close_gap(table, wc - table->slots);
+  return true;
+}
+
+#ifdef WORD_STRIPED
+
+static void lock_all(word_count_list_t* wclist, bool write) {
+  for (int i = 0; i < WORD_STRIPES; i++) {
+    if (write)
+      pthread_rwlock_wrlock(&wclist->stripes[i].lock);
+    else
+      pthread_rwlock_rdlock(&wclist->stripes[i].lock);
+  }
+}
+
+static void unlock_all(word_count_list_t* wclist) {
+  for (int i = 0; i < WORD_STRIPES; i++)
+    pthread_rwlock_unlock(&wclist->stripes[i].lock);
+}
+
+void init_words(word_count_list_t* wclist) {
+  for (int i = 0; i < WORD_STRIPES; i++) {
+    wclist->stripes[i].table = (word_table_t){NULL, 0, 0};
+    pthread_rwlock_init(&wclist->stripes[i].lock, NULL);
+  }
+  wclist->sorted = NULL;
+}
+
+size_t len_words(word_count_list_t* wclist) {
+  size_t len = 0;
+  for (int i = 0; i < WORD_STRIPES; i++) {
+    pthread_rwlock_rdlock(&wclist->stripes[i].lock);
+    len += wclist->stripes[i].table.size;
+    pthread_rwlock_unlock(&wclist->stripes[i].lock);
+  }
+  return len;
+}
+
+word_count_t* find_word(word_count_list_t* wclist, char* word) {
+  size_t len = strlen(word);
+  uint32_t hash = hash_word(word, len);
+  word_stripe_t* stripe = STRIPE(wclist, hash);
+  pthread_rwlock_rdlock(&stripe->lock);
+  word_count_t* wc = lookup(&stripe->table, word, len, hash);
+  pthread_rwlock_unlock(&stripe->lock);
+  return wc;
+}
+
+/* Counts the LEN bytes at WORD, taking OWNED as count_word() does. */
+static word_count_t* count_striped(word_count_list_t* wclist, const char* word, size_t len,
+                                   char* owned) {
+  uint32_t hash = hash_word(word, len);
+  word_stripe_t* stripe = STRIPE(wclist, hash);
+
+  pthread_rwlock_rdlock(&stripe->lock);
+  word_count_t* wc = lookup(&stripe->table, word, len, hash);
+  if (wc != NULL)
+    __atomic_add_fetch(&wc->count, 1, __ATOMIC_RELAXED);
+  pthread_rwlock_unlock(&stripe->lock);
+  if (wc != NULL) {
+    free(owned);
+    return wc;
+  }
+
+  /* Another thread may add the word before we get the write lock. */
+  pthread_rwlock_wrlock(&stripe->lock);
+  wc = count_word(wclist, &stripe->table, word, len, hash, owned);
+  pthread_rwlock_unlock(&stripe->lock);
+  return wc;
+}
+
+word_count_t* add_word(word_count_list_t* wclist, char* word) {
+  return count_striped(wclist, word, strlen(word), word);
+}
+
+word_count_t* add_word_span(word_count_list_t* wclist, const char* word, size_t len) {
+  return count_striped(wclist, word, len, NULL);
+}
+
+bool remove_word(word_count_list_t* wclist, const char* word) {
+  size_t len = strlen(word);
+  uint32_t hash = hash_word(word, len);
+  word_stripe_t* stripe = STRIPE(wclist, hash);
+  pthread_rwlock_wrlock(&stripe->lock);
+  bool found = remove_entry(wclist, &stripe->table, word, len, hash);
+  pthread_rwlock_unlock(&stripe->lock);
+  return found;
+}
+
+bool merge_words(word_count_list_t* dest, word_count_list_t* src) {
+  if (dest == src)
+    return true;
+  /* Lists lock in address order, so merges in opposite directions cannot deadlock. */
+  word_count_list_t* first = dest < src ? dest : src;
+  word_count_list_t* second = dest < src ? src : dest;
+  lock_all(first, true);
+  lock_all(second, true);
+  forget_order(dest);
+  forget_order(src);
+
+  bool ok = true;
+  for (int i = 0; i < WORD_STRIPES && ok; i++) {
+    word_table_t* from = &src->stripes[i].table;
+    for (size_t j = 0; ok && j < from->capacity;) {
+      word_count_t* wc = &from->slots[j];
+      if (wc->word == NULL)
+        j++;
+      else
+        ok = take_entry(&STRIPE(dest, wc->hash)->table, from, j);
+    }
+    if (ok) {
+      free(from->slots);
+      *from = (word_table_t){NULL, 0, 0};
+    }
+  }
+  unlock_all(second);
+  unlock_all(first);
+  return ok;
+}
+
+#else /* WORD_STRIPED */
+
+static void lock_all(word_count_list_t* wclist, bool write) { LOCK(wclist); }
+
+static void unlock_all(word_count_list_t* wclist) { UNLOCK(wclist); }
+
+void init_words(word_count_list_t* wclist) {
+  wclist->table = (word_table_t){NULL, 0, 0};
+  wclist->sorted = NULL;
+#ifdef PTHREADS
+  pthread_mutex_init(&wclist->lock, NULL);
+#endif
+}
+
+size_t len_words(word_count_list_t* wclist) {
+  LOCK(wclist);
+  size_t len = wclist->table.size;
+  UNLOCK(wclist);
+  return len;
+}
+
+word_count_t* find_word(word_count_list_t* wclist, char* word) {
+  size_t len = strlen(word);
+  uint32_t hash = hash_word(word, len);
+  LOCK(wclist);
+  word_count_t* wc = lookup(&wclist->table, word, len, hash);
+  UNLOCK(wclist);
+  return wc;
+}
+
+word_count_t* add_word(word_count_list_t* wclist, char* word) {
+  size_t len = strlen(word);
+  uint32_t hash = hash_word(word, len);
+  LOCK(wclist);
+  word_count_t* wc = count_word(wclist, &wclist->table, word, len, hash, word);
+  UNLOCK(wclist);
+  return wc;
+}
+
+word_count_t* add_word_span(word_count_list_t* wclist, const char* word, size_t len) {
+  uint32_t hash = hash_word(word, len);
+  LOCK(wclist);
+  word_count_t* wc = count_word(wclist, &wclist->table, word, len, hash, NULL);
+  UNLOCK(wclist);
+  return wc;
+}
+
+bool remove_word(word_count_list_t* wclist, const char* word) {
+  size_t len = strlen(word);
+  uint32_t hash = hash_word(word, len);
+  LOCK(wclist);
+  bool found = remove_entry(wclist, &wclist->table, word, len, hash);
+  UNLOCK(wclist);
+  return found;
+}
+
+bool merge_words(word_count_list_t* dest, word_count_list_t* src) {
+  if (dest == src)
+    return true;
+  /* Lists lock in address order, so merges in opposite directions cannot deadlock. */
+  LOCK(dest < src ? dest : src);
+  LOCK(dest < src ? src : dest);
+  forget_order(dest);
+  forget_order(src);
+  word_table_t* from = &src->table;
+  for (size_t i = 0; i < from->capacity;) {
+    if (from->slots[i].word == NULL) {
+      i++;
+    } else if (!take_entry(&dest->table, from, i)) {
+      UNLOCK(src);
+      UNLOCK(dest);
+      return false;
+    }
+  }
+  free(from->slots);
+  *from = (word_table_t){NULL, 0, 0};
+  UNLOCK(src);
+  UNLOCK(dest);
+  return true;
+}
+
+#endif /* WORD_STRIPED */
+
+void for_each_word(word_count_list_t* wclist, void visit(word_count_t*, void*), void* aux) {
+  lock_all(wclist, false);
+  for (int t = 0; t < NUM_TABLES; t++) {
+    word_table_t* table = TABLE(wclist, t);
+    for (size_t i = 0; i < table->capacity; i++) {
+      if (table->slots[i].word != NULL)
+        visit(&table->slots[i], aux);
+    }
+  }
+  unlock_all(wclist);
+}
+
+void destroy_words(word_count_list_t* wclist) {
+  for (int t = 0; t < NUM_TABLES; t++) {
+    word_table_t* table = TABLE(wclist, t);
+    for (size_t i = 0; i < table->capacity; i++) {
+      word_count_t* wc = &table->slots[i];
+      if (wc->word != NULL && wc->word != wc->key)
+        free(wc->word);
+    }
+    free(table->slots);
+    *table = (word_table_t){NULL, 0, 0};
+#ifdef WORD_STRIPED
+    pthread_rwlock_destroy(&wclist->stripes[t].lock);
+#endif
+  }
+  forget_order(wclist);
+#if defined(PTHREADS) && !defined(WORD_STRIPED)
+  pthread_mutex_destroy(&wclist->lock);
+#endif
+}
+
+void fprint_memory_usage(word_count_list_t* wclist, FILE* outfile) {
+  size_t words = 0, slots = 0, long_words = 0, long_bytes = 0;
+  lock_all(wclist, false);
+  for (int t = 0; t < NUM_TABLES; t++) {
+    word_table_t* table = TABLE(wclist, t);
+    words += table->size;
+    slots += table->capacity;
+    for (size_t i = 0; i < table->capacity; i++) {
+      word_count_t* wc = &table->slots[i];
+      if (wc->word != NULL && wc->word != wc->key) {
+        long_words++;
+        long_bytes += strlen(wc->word) + 1;
+      }
+    }
+  }
+  unlock_all(wclist);
+  fprintf(outfile, "%zu words in %zu slots: %zu bytes\n", words, slots,
+          slots * sizeof(word_count_t));
+  fprintf(outfile, "%zu words inline, %zu malloc'd: %zu bytes\n", words - long_words,
+          long_words, long_bytes);
+}
+
+void fprint_words(word_count_list_t* wclist, FILE* outfile) {
+  lock_all(wclist, false);
+  if (wclist->sorted != NULL) {
+    for (word_count_t** wc = wclist->sorted; *wc != NULL; wc++)
+      fprintf(outfile, "%i\t%s\n", (*wc)->count, (*wc)->word);
+  } else {
+    for (int t = 0; t < NUM_TABLES; t++) {
+      word_table_t* table = TABLE(wclist, t);
+      for (size_t i = 0; i < table->capacity; i++) {
+        word_count_t* wc = &table->slots[i];
+        if (wc->word != NULL)
+          fprintf(outfile, "%i\t%s\n", wc->count, wc->word);
+      }
+    }
+  }
+  unlock_all(wclist);
+}
+
+/* Stable merge sort of the N entries at ITEMS, using SCRATCH for merging. */
+static void merge_sort(word_count_t** items, word_count_t** scratch, size_t n,
+                       bool less(const word_count_t*, const word_count_t*)) {
+  if (n < 2)
+    return;
+  size_t half = n / 2;
+  merge_sort(items, scratch, half, less);
+  merge_sort(items + half, scratch, n - half, less);
+
+  size_t i = 0, j = half, k = 0;
+  while (i < half && j < n)
+    scratch[k++] = less(items[j], items[i]) ? items[j++] : items[i++];
+  while (i < half)
+    scratch[k++] = items[i++];
+  while (j < n)
+    scratch[k++] = items[j++];
+  memcpy(items, scratch, n * sizeof(word_count_t*));
+}
+
+void wordcount_sort(word_count_list_t* wclist,
+                    bool less(const word_count_t*, const word_count_t*)) {
+  lock_all(wclist, true);
+  forget_order(wclist);
+  size_t size = 0;
+  for (int t = 0; t < NUM_TABLES; t++)
+    size += TABLE(wclist, t)->size;
+
+  /* The sorted array is NULL-terminated. */
+  word_count_t** sorted = malloc((size + 1) * sizeof(word_count_t*));
+  word_count_t** scratch = malloc((size + 1) * sizeof(word_count_t*));
+  if (sorted == NULL || scratch == NULL) {
+    free(sorted);
+    free(scratch);
+    unlock_all(wclist);
+    return;
+  }
+
+  size_t n = 0;
+  for (int t = 0; t < NUM_TABLES; t++) {
+    word_table_t* table = TABLE(wclist, t);
+    for (size_t i = 0; i < table->capacity; i++) {
+      if (table->slots[i].word != NULL)
+        sorted[n++] = &table->slots[i];
+    }
+  }
+  sorted[n] = NULL;
+  merge_sort(sorted, scratch, n, less);
+  free(scratch);
+  wclist->sorted = sorted;
+  unlock_all(wclist);
+}
@@ -64,6 +64,20 @@ word_count_t* add_word(word_count_list_t* wclist, char* word) {
   return new_node;
 }
 
+void for_each_word(word_count_list_t* wclist, void visit(word_count_t*, void*), void* aux) {
+  struct list_elem* e;
+  for (e = list_begin(wclist); e != list_end(wclist); e = list_next(e))
+    visit(list_entry(e, word_count_t, elem), aux);
+}
+
+void destroy_words(word_count_list_t* wclist) {
+  while (!list_empty(wclist)) {
+    word_count_t* wc = list_entry(list_pop_front(wclist), word_count_t, elem);
+    free(wc->word);
+    free(wc);
+  }
+}
+
 void fprint_words(word_count_list_t* wclist, FILE* outfile) {
   /* TODO */
   /* Please follow this format: fprintf(<file>, "%i\t%s\n", <count>, <word>); */
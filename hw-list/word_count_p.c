@@ -33,6 +33,7 @@
 void init_words(word_count_list_t* wclist) { 
   /* TODO */
   list_init(&wclist->lst);
+  arena_init(&wclist->arena);
   pthread_mutex_init(&wclist->lock, NULL);
 }
 
@@ -45,56 +46,121 @@ size_t len_words(word_count_list_t* wclist) {
   return len;
 }
 // Helper function without locking for internal use
-static word_count_t* find_word_internal(word_count_list_t* wclist, char* word) {
+static word_count_t* find_word_internal(word_count_list_t* wclist, const char* word, size_t len) {
     struct list_elem* e;
     for (e = list_begin(&wclist->lst); e != list_end(&wclist->lst); e = list_next(e)) {
         word_count_t* wc = list_entry(e, word_count_t, elem);
-        if (strcmp(wc->word, word) == 0) {
+        if (strncmp(wc->word, word, len) == 0 && wc->word[len] == '\0') {
             return wc;
         }
     }
     return NULL;
 }
 
+// Adds the len bytes at word with the given count; the node and a copy of
+// the word come from the list's arena. Returns NULL if out of memory.
+static word_count_t* new_word_internal(word_count_list_t* wclist, const char* word, size_t len,
+                                       int count) {
+  word_count_t* new_node = arena_alloc(&wclist->arena, sizeof(word_count_t));
+  if (new_node == NULL) {
+    return NULL;
+  }
+  new_node->word = arena_strndup(&wclist->arena, word, len);
+  if (new_node->word == NULL) {
+    return NULL;
+  }
+  new_node->count = count;
+  list_push_back(&wclist->lst, &new_node->elem);
+  return new_node;
+}
+
 word_count_t* find_word(word_count_list_t* wclist, char* word) {
   /* TODO */
   // it is like word_count_l.c but with mutexes
   pthread_mutex_lock(&wclist->lock);
-  word_count_t* wc = find_word_internal(wclist, word);
+  word_count_t* wc = find_word_internal(wclist, word, strlen(word));
   pthread_mutex_unlock(&wclist->lock);
   return wc;
 }
 
 word_count_t* add_word(word_count_list_t* wclist, char* word) {
-  /* TODO */
+  word_count_t* wc = add_word_span(wclist, word, strlen(word));
+  // The list keeps its own copy of the word.
+  if (wc != NULL) {
+    free(word);
+  }
+  return wc;
+}
+
+word_count_t* add_word_span(word_count_list_t* wclist, const char* word, size_t len) {
   pthread_mutex_lock(&wclist->lock);
-  word_count_t *existing = find_word_internal(wclist, word);
-  if (existing != NULL) {
-    existing->count++;
-    pthread_mutex_unlock(&wclist->lock);
-    return existing;
+  word_count_t* wc = find_word_internal(wclist, word, len);
+  if (wc != NULL) {
+    wc->count++;
+  } else {
+    wc = new_word_internal(wclist, word, len, 1);
   }
+  pthread_mutex_unlock(&wclist->lock);
+  return wc;
+}
 
-  // create new word_count_t
-  word_count_t *new_node = malloc(sizeof(word_count_t));
-  if (new_node == NULL) {
-    pthread_mutex_unlock(&wclist->lock);
-    return NULL;
+// The node stays in the arena until destroy_words().
+bool remove_word(word_count_list_t* wclist, const char* word) {
+  pthread_mutex_lock(&wclist->lock);
+  word_count_t* wc = find_word_internal(wclist, word, strlen(word));
+  if (wc != NULL) {
+    list_remove(&wc->elem);
   }
-  
-  new_node->word = strdup(word);
-  if (new_node->word == NULL) {
-    free(new_node);
-    pthread_mutex_unlock(&wclist->lock);
-    return NULL;
+  pthread_mutex_unlock(&wclist->lock);
+  return wc != NULL;
+}
+
+// Copies src's words into dest's arena, then drops src's arena whole.
+bool merge_words(word_count_list_t* dest, word_count_list_t* src) {
+  pthread_mutex_lock(&dest->lock);
+  pthread_mutex_lock(&src->lock);
+  while (!list_empty(&src->lst)) {
+    word_count_t* wc = list_entry(list_front(&src->lst), word_count_t, elem);
+    size_t len = strlen(wc->word);
+    word_count_t* existing = find_word_internal(dest, wc->word, len);
+    if (existing != NULL) {
+      existing->count += wc->count;
+    } else if (new_word_internal(dest, wc->word, len, wc->count) == NULL) {
+      pthread_mutex_unlock(&src->lock);
+      pthread_mutex_unlock(&dest->lock);
+      return false;
+    }
+    list_pop_front(&src->lst);
   }
+  arena_destroy(&src->arena);
+  pthread_mutex_unlock(&src->lock);
+  pthread_mutex_unlock(&dest->lock);
+  return true;
+}
 
-  new_node->count = 1;
-  list_push_back(&wclist->lst, &new_node->elem);
-  pthread_mutex_unlock(&wclist->lock);
+void destroy_words(word_count_list_t* wclist) {
+  arena_destroy(&wclist->arena);
+  list_init(&wclist->lst);
+  pthread_mutex_destroy(&wclist->lock);
+}
 
-  return new_node;
+void fprint_memory_usage(word_count_list_t* wclist, FILE* outfile) {
+  pthread_mutex_lock(&wclist->lock);
+  arena_t* arena = &wclist->arena;
+  fprintf(outfile, "%zu words: %zu allocations of %zu bytes\n", list_size(&wclist->lst),
+          arena->allocations, arena->requested);
+  fprintf(outfile, "arena:  %zu bytes\n", arena->reserved);
+  fprintf(outfile, "malloc: %zu bytes\n", arena->malloc_bytes);
+  fprintf(outfile, "saved:  %ld bytes\n", (long)arena->malloc_bytes - (long)arena->reserved);
+  pthread_mutex_unlock(&wclist->lock);
+}
 
+void for_each_word(word_count_list_t* wclist, void visit(word_count_t*, void*), void* aux) {
+  pthread_mutex_lock(&wclist->lock);
+  struct list_elem* e;
+  for (e = list_begin(&wclist->lst); e != list_end(&wclist->lst); e = list_next(e))
+    visit(list_entry(e, word_count_t, elem), aux);
+  pthread_mutex_unlock(&wclist->lock);
 }
 
 void fprint_words(word_count_list_t* wclist, FILE* outfile) {
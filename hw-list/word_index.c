@@ -0,0 +1,376 @@
+/*
+ * Implementation of the word_index interface.
+ *
+ * Sorted words share long prefixes, so storing only what changes from one
+ * word to the next makes an index little more than half the size of the
+ * text fprint_words() prints for the same counts, and every file still
+ * reads front to back in one pass. Merging k indexes is then a k-way merge
+ * over their cursors, O(n log k) for n entries in all, with no more memory
+ * than one word per index.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "word_index.h"
+
+#define INDEX_MAGIC "WCIX"
+#define INDEX_VERSION 1
+#define HEADER_SIZE 16
+
+static void put_le(unsigned char* buf, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; i++)
+    buf[i] = value >> (8 * i);
+}
+
+static uint64_t get_le(const unsigned char* buf, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; i++)
+    value |= (uint64_t)buf[i] << (8 * i);
+  return value;
+}
+
+/*
+ * Writes entries in order, each against the one before it, to a temporary
+ * file beside the destination that replaces it only once it is complete.
+ */
+typedef struct writer {
+  FILE* file;
+  const char* path;
+  char* temp;
+  char* prev;
+  size_t prev_len;
+  size_t prev_capacity;
+  uint64_t entries;
+} writer_t;
+
+static void put_varint(FILE* file, uint64_t value) {
+  while (value >= 0x80) {
+    putc((value & 0x7f) | 0x80, file);
+    value >>= 7;
+  }
+  putc(value, file);
+}
+
+static bool open_writer(writer_t* writer, const char* path) {
+  *writer = (writer_t){NULL, path, malloc(strlen(path) + sizeof(".XXXXXX"))};
+  if (writer->temp == NULL)
+    return false;
+  strcpy(writer->temp, path);
+  strcat(writer->temp, ".XXXXXX");
+  int fd = mkstemp(writer->temp);
+  if (fd < 0) {
+    free(writer->temp);
+    writer->temp = NULL;
+    return false;
+  }
+  /* Give the index the permissions fopen() would have. */
+  mode_t mask = umask(0);
+  umask(mask);
+  if (fchmod(fd, 0666 & ~mask) < 0 || (writer->file = fdopen(fd, "wb")) == NULL) {
+    close(fd);
+    return false;
+  }
+  /* The entry count is filled in by close_writer(). */
+  unsigned char header[HEADER_SIZE] = INDEX_MAGIC;
+  put_le(header + 4, INDEX_VERSION, 4);
+  return fwrite(header, HEADER_SIZE, 1, writer->file) == 1;
+}
+
+/* Appends WORD, which must sort after the last word written. */
+static bool write_entry(const char* word, size_t len, uint64_t count, void* aux) {
+  writer_t* writer = aux;
+  size_t shared = 0;
+  while (shared < len && shared < writer->prev_len && word[shared] == writer->prev[shared])
+    shared++;
+  put_varint(writer->file, shared);
+  put_varint(writer->file, len - shared);
+  fwrite(word + shared, 1, len - shared, writer->file);
+  put_varint(writer->file, count);
+
+  if (len > writer->prev_capacity) {
+    char* prev = realloc(writer->prev, len);
+    if (prev == NULL)
+      return false;
+    writer->prev = prev;
+    writer->prev_capacity = len;
+  }
+  memcpy(writer->prev, word, len);
+  writer->prev_len = len;
+  writer->entries++;
+  return !ferror(writer->file);
+}
+
+/*
+ * Finishes the index and moves it over the destination if OK, so far, or
+ * removes it otherwise. Returns whether the destination was replaced.
+ */
+static bool close_writer(writer_t* writer, bool ok) {
+  if (writer->file != NULL) {
+    unsigned char entries[8];
+    put_le(entries, writer->entries, 8);
+    ok = ok && !ferror(writer->file) && fseek(writer->file, 8, SEEK_SET) == 0 &&
+         fwrite(entries, 8, 1, writer->file) == 1;
+    ok = fclose(writer->file) == 0 && ok;
+  }
+  if (writer->temp != NULL) {
+    ok = ok && rename(writer->temp, writer->path) == 0;
+    if (!ok) {
+      int saved = errno;
+      unlink(writer->temp);
+      errno = saved;
+    }
+  }
+  free(writer->temp);
+  free(writer->prev);
+  return ok;
+}
+
+static void collect(word_count_t* wc, void* aux) {
+  word_count_t*** next = aux;
+  *(*next)++ = wc;
+}
+
+static int compare_words(const void* a, const void* b) {
+  return strcmp((*(word_count_t* const*)a)->word, (*(word_count_t* const*)b)->word);
+}
+
+bool save_index(word_count_list_t* wclist, const char* path) {
+  size_t len = len_words(wclist);
+  word_count_t** words = malloc(len * sizeof(word_count_t*));
+  if (words == NULL && len > 0)
+    return false;
+  word_count_t** next = words;
+  for_each_word(wclist, collect, &next);
+  qsort(words, len, sizeof(word_count_t*), compare_words);
+
+  writer_t writer;
+  bool ok = open_writer(&writer, path);
+  for (size_t i = 0; ok && i < len; i++)
+    ok = write_entry(words[i]->word, strlen(words[i]->word), words[i]->count, &writer);
+  ok = close_writer(&writer, ok);
+  free(words);
+  return ok;
+}
+
+static bool corrupt(void) {
+  errno = EINVAL;
+  return false;
+}
+
+bool open_index(word_index_t* index, const char* path) {
+  *index = (word_index_t){NULL};
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size < HEADER_SIZE) {
+    close(fd);
+    return corrupt();
+  }
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return false;
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+  index->data = data;
+  index->size = st.st_size;
+  if (memcmp(index->data, INDEX_MAGIC, 4) != 0 || get_le(index->data + 4, 4) != INDEX_VERSION) {
+    close_index(index);
+    return corrupt();
+  }
+  index->entries = get_le(index->data + 8, 8);
+  index->pos = index->data + HEADER_SIZE;
+  if (index->entries == 0 && index->size != HEADER_SIZE) {
+    close_index(index);
+    return corrupt();
+  }
+  return true;
+}
+
+static bool get_varint(word_index_t* index, uint64_t* value) {
+  const unsigned char* end = index->data + index->size;
+  *value = 0;
+  for (int shift = 0; shift < 64 && index->pos < end; shift += 7) {
+    unsigned char byte = *index->pos++;
+    *value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+bool next_index_entry(word_index_t* index) {
+  if (index->entries == 0)
+    return false;
+  uint64_t shared, rest, count;
+  if (!get_varint(index, &shared) || !get_varint(index, &rest) || shared > index->len ||
+      rest > (uint64_t)(index->data + index->size - index->pos))
+    return corrupt();
+
+  /* Each word must sort after the one before it. */
+  if (rest == 0 || (shared < index->len && *index->pos <= (unsigned char)index->word[shared]))
+    return corrupt();
+
+  size_t len = shared + rest;
+  if (len + 1 > index->capacity) {
+    size_t capacity = index->capacity ? index->capacity : 32;
+    while (len + 1 > capacity)
+      capacity *= 2;
+    char* word = realloc(index->word, capacity);
+    if (word == NULL)
+      return false;
+    index->word = word;
+    index->capacity = capacity;
+  }
+  memcpy(index->word + shared, index->pos, rest);
+  index->word[len] = '\0';
+  index->pos += rest;
+  if (!get_varint(index, &count))
+    return corrupt();
+  /* Nothing may follow the last entry. */
+  if (index->entries == 1 && index->pos != index->data + index->size)
+    return corrupt();
+  index->len = len;
+  index->count = count;
+  index->entries--;
+  return true;
+}
+
+void close_index(word_index_t* index) {
+  if (index->data != NULL)
+    munmap((void*)index->data, index->size);
+  free(index->word);
+  *index = (word_index_t){NULL};
+}
+
+/* Min-heap of cursors by current word. */
+static void sift_down(word_index_t** heap, int size, int i) {
+  for (;;) {
+    int least = i;
+    int left = 2 * i + 1;
+    int right = left + 1;
+    if (left < size && strcmp(heap[left]->word, heap[least]->word) < 0)
+      least = left;
+    if (right < size && strcmp(heap[right]->word, heap[least]->word) < 0)
+      least = right;
+    if (least == i)
+      return;
+    word_index_t* tmp = heap[i];
+    heap[i] = heap[least];
+    heap[least] = tmp;
+    i = least;
+  }
+}
+
+bool merge_indexes(word_index_t* indexes, int n,
+                   bool emit(const char*, size_t, uint64_t, void*), void* aux) {
+  word_index_t** heap = malloc(n * sizeof(word_index_t*));
+  char* word = NULL;
+  size_t capacity = 0;
+  bool ok = heap != NULL || n == 0;
+
+  int size = 0;
+  for (int i = 0; ok && i < n; i++) {
+    if (next_index_entry(&indexes[i]))
+      heap[size++] = &indexes[i];
+    else
+      ok = indexes[i].entries == 0;
+  }
+  for (int i = size / 2 - 1; i >= 0; i--)
+    sift_down(heap, size, i);
+
+  while (ok && size > 0) {
+    /* Take the least word from every index that has it. */
+    size_t len = heap[0]->len;
+    if (len + 1 > capacity) {
+      char* grown = realloc(word, len + 1);
+      if (grown == NULL) {
+        ok = false;
+        break;
+      }
+      word = grown;
+      capacity = len + 1;
+    }
+    memcpy(word, heap[0]->word, len + 1);
+    uint64_t total = 0;
+    while (ok && size > 0 && strcmp(heap[0]->word, word) == 0) {
+      total += heap[0]->count;
+      if (!next_index_entry(heap[0])) {
+        ok = heap[0]->entries == 0;
+        heap[0] = heap[--size];
+      }
+      sift_down(heap, size, 0);
+    }
+    ok = ok && emit(word, len, total, aux);
+  }
+  free(word);
+  free(heap);
+  return ok;
+}
+
+/* Opens N indexes into a new array, or returns NULL. */
+static word_index_t* open_indexes(char* paths[], int n) {
+  word_index_t* indexes = calloc(n, sizeof(word_index_t));
+  for (int i = 0; indexes != NULL && i < n; i++) {
+    if (!open_index(&indexes[i], paths[i])) {
+      int saved = errno;
+      while (i-- > 0)
+        close_index(&indexes[i]);
+      free(indexes);
+      errno = saved;
+      return NULL;
+    }
+  }
+  return indexes;
+}
+
+static void close_indexes(word_index_t* indexes, int n) {
+  for (int i = 0; i < n; i++)
+    close_index(&indexes[i]);
+  free(indexes);
+}
+
+bool merge_index_files(char* paths[], int n, const char* out) {
+  struct stat out_st, st;
+  if (stat(out, &out_st) == 0) {
+    for (int i = 0; i < n; i++) {
+      if (stat(paths[i], &st) == 0 && st.st_dev == out_st.st_dev && st.st_ino == out_st.st_ino) {
+        errno = EINVAL;
+        return false;
+      }
+    }
+  }
+  word_index_t* indexes = open_indexes(paths, n);
+  if (indexes == NULL)
+    return false;
+  writer_t writer;
+  bool ok = open_writer(&writer, out) && merge_indexes(indexes, n, write_entry, &writer);
+  ok = close_writer(&writer, ok);
+  close_indexes(indexes, n);
+  return ok;
+}
+
+static bool add_entry(const char* word, size_t len, uint64_t count, void* aux) {
+  word_count_list_t* wclist = aux;
+  word_count_t* wc = add_word_span(wclist, word, len);
+  if (wc == NULL || count > (uint64_t)INT_MAX - wc->count + 1)
+    return false;
+  wc->count += count - 1;
+  return true;
+}
+
+bool load_indexes(word_count_list_t* wclist, char* paths[], int n) {
+  word_index_t* indexes = open_indexes(paths, n);
+  if (indexes == NULL)
+    return false;
+  bool ok = merge_indexes(indexes, n, add_entry, wclist);
+  close_indexes(indexes, n);
+  return ok;
+}
@@ -0,0 +1,70 @@
+/*
+ * The word_index interface saves word counts in a compact binary file, so
+ * that counts from separate runs can be combined later without counting the
+ * text again.
+ *
+ * An index file is a 16-byte header, the magic "WCIX", a 32-bit version and
+ * a 64-bit entry count, both little-endian, followed by one entry per word
+ * in strcmp() order. Each entry is three LEB128 varints and some bytes: the
+ * length the word shares with the previous word, the length of the rest,
+ * the rest, and the count.
+ */
+
+#ifndef WORD_INDEX_H
+#define WORD_INDEX_H
+
+#include <stdint.h>
+
+#include "word_count.h"
+
+/* A mapped index file, read one entry at a time. */
+typedef struct word_index {
+  const unsigned char* data;
+  size_t size;
+  const unsigned char* pos;
+  uint64_t entries; /* Entries not yet read. */
+  char* word;       /* Current entry, NUL-terminated. */
+  size_t len;
+  size_t capacity;
+  uint64_t count;
+} word_index_t;
+
+/*
+ * Writes the counts in WCLIST to PATH, through a temporary file that
+ * replaces PATH only once complete. Returns false on error, with errno set.
+ */
+bool save_index(word_count_list_t* wclist, const char* path);
+
+/*
+ * Maps the index at PATH, positioned before its first entry. Returns false
+ * if it cannot be read or is not an index. An index with bytes after its
+ * last entry is corrupt.
+ */
+bool open_index(word_index_t* index, const char* path);
+
+/*
+ * Steps INDEX to its next entry. Returns false at the end, or if the file
+ * is corrupt, in which case index->entries is still nonzero.
+ */
+bool next_index_entry(word_index_t* index);
+
+void close_index(word_index_t* index);
+
+/*
+ * Combines N indexes in one pass over each, calling emit(word, len, count,
+ * aux) once per distinct word, in strcmp() order, with its total count.
+ * Returns false if an index is corrupt, or emit returns false.
+ */
+bool merge_indexes(word_index_t* indexes, int n,
+                   bool emit(const char*, size_t, uint64_t, void*), void* aux);
+
+/*
+ * Combines the indexes at N PATHS into a new index at OUT, written as
+ * save_index() writes. Fails with EINVAL if OUT is one of the PATHS.
+ */
+bool merge_index_files(char* paths[], int n, const char* out);
+
+/* Adds the counts in the indexes at N PATHS to WCLIST. */
+bool load_indexes(word_count_list_t* wclist, char* paths[], int n);
+
+#endif /* WORD_INDEX_H */
@@ -0,0 +1,215 @@
+/*
+ * Implementation of the word_scan interface.
+ *
+ * The input is classified 64 bytes at a time into a bitmask of letters, with
+ * a lowercased copy of the block made in the same pass, using AVX2 or SSE2
+ * where available. Words are then the runs of set bits, found with
+ * count-trailing-zeros, and go to add_word_span() straight from the
+ * lowercased block, or from a small buffer if they span blocks.
+ *
+ * Letters are ASCII letters, which is what isalpha() accepts in the C locale.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+#include "word_scan.h"
+
+#define BLOCK_SIZE 64
+
+/* Bytes count_words_fd() reads at a time. */
+#define READ_SIZE (64 * 1024)
+
+/* Sets OUT to the BLOCK_SIZE bytes at IN, lowercased; returns their letters. */
+typedef uint64_t classify_fn(const char* in, char* out);
+
+static uint64_t classify_scalar(const char* in, char* out) {
+  uint64_t letters = 0;
+  for (int i = 0; i < BLOCK_SIZE; i++) {
+    unsigned char folded = in[i] | 0x20;
+    bool letter = (unsigned char)(folded - 'a') < 26;
+    out[i] = letter ? folded : in[i];
+    letters |= (uint64_t)letter << i;
+  }
+  return letters;
+}
+
+#ifdef HAVE_X86
+/*
+ * With the case bit set, letters are 'a' through 'z'. Adding 0x80 - 'a' moves
+ * that range to the bottom of the signed bytes, where one signed compare
+ * against -128 + 26 picks it out.
+ */
+static uint64_t classify_sse2(const char* in, char* out) {
+  const __m128i case_bit = _mm_set1_epi8(0x20);
+  const __m128i shift = _mm_set1_epi8((char)(0x80 - 'a'));
+  const __m128i limit = _mm_set1_epi8((char)(0x80 + 26));
+  uint64_t letters = 0;
+  for (int i = 0; i < BLOCK_SIZE; i += 16) {
+    __m128i c = _mm_loadu_si128((const __m128i*)(in + i));
+    __m128i folded = _mm_or_si128(c, case_bit);
+    __m128i letter = _mm_cmplt_epi8(_mm_add_epi8(folded, shift), limit);
+    _mm_storeu_si128((__m128i*)(out + i), _mm_or_si128(c, _mm_and_si128(letter, case_bit)));
+    letters |= (uint64_t)(uint16_t)_mm_movemask_epi8(letter) << i;
+  }
+  return letters;
+}
+
+__attribute__((target("avx2"))) static uint64_t classify_avx2(const char* in, char* out) {
+  const __m256i case_bit = _mm256_set1_epi8(0x20);
+  const __m256i shift = _mm256_set1_epi8((char)(0x80 - 'a'));
+  const __m256i limit = _mm256_set1_epi8((char)(0x80 + 26));
+  uint64_t letters = 0;
+  for (int i = 0; i < BLOCK_SIZE; i += 32) {
+    __m256i c = _mm256_loadu_si256((const __m256i*)(in + i));
+    __m256i folded = _mm256_or_si256(c, case_bit);
+    __m256i letter = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(folded, shift));
+    _mm256_storeu_si256((__m256i*)(out + i),
+                        _mm256_or_si256(c, _mm256_and_si256(letter, case_bit)));
+    letters |= (uint64_t)(uint32_t)_mm256_movemask_epi8(letter) << i;
+  }
+  return letters;
+}
+#endif
+
+static classify_fn* pick_classifier(void) {
+#ifdef HAVE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return classify_avx2;
+  if (__builtin_cpu_supports("sse2"))
+    return classify_sse2;
+#endif
+  return classify_scalar;
+}
+
+/* A word that continues past the end of a block. */
+typedef struct {
+  char* data;
+  size_t len;
+  size_t capacity;
+  char inline_data[128];
+} partial_t;
+
+static bool extend_partial(partial_t* partial, const char* data, size_t len) {
+  if (partial->len + len > partial->capacity) {
+    size_t capacity = partial->capacity * 2;
+    while (capacity < partial->len + len)
+      capacity *= 2;
+    char* grown = partial->data == partial->inline_data ? malloc(capacity)
+                                                        : realloc(partial->data, capacity);
+    if (grown == NULL)
+      return false;
+    if (partial->data == partial->inline_data)
+      memcpy(grown, partial->inline_data, partial->len);
+    partial->data = grown;
+    partial->capacity = capacity;
+  }
+  memcpy(partial->data + partial->len, data, len);
+  partial->len += len;
+  return true;
+}
+
+/* Counts WORD, skipping single letters as count_words() does. */
+static bool count_span(word_count_list_t* wclist, const char* word, size_t len) {
+  return len < 2 || add_word_span(wclist, word, len) != NULL;
+}
+
+bool count_words_mem(word_count_list_t* wclist, const char* data, size_t size) {
+  classify_fn* classify = pick_classifier();
+  char lower[BLOCK_SIZE];
+  char tail[BLOCK_SIZE];
+  partial_t partial = {NULL, 0, sizeof(partial.inline_data)};
+  partial.data = partial.inline_data;
+  bool ok = true;
+
+  for (size_t offset = 0; ok && offset < size; offset += BLOCK_SIZE) {
+    size_t n = size - offset < BLOCK_SIZE ? size - offset : BLOCK_SIZE;
+    const char* block = data + offset;
+    if (n < BLOCK_SIZE) {
+      memset(tail, ' ', BLOCK_SIZE);
+      memcpy(tail, block, n);
+      block = tail;
+    }
+    uint64_t letters = classify(block, lower);
+
+    size_t pos = 0;
+    while (ok && pos < BLOCK_SIZE) {
+      uint64_t rest = letters >> pos;
+      if (rest & 1) {
+        /* A run of letters; the bits above the shifted mask are zero. */
+        size_t run = ~rest == 0 ? BLOCK_SIZE : (size_t)__builtin_ctzll(~rest);
+        if (pos + run == BLOCK_SIZE || partial.len > 0) {
+          ok = extend_partial(&partial, lower + pos, run);
+          if (ok && pos + run < BLOCK_SIZE) {
+            ok = count_span(wclist, partial.data, partial.len);
+            partial.len = 0;
+          }
+        } else {
+          ok = count_span(wclist, lower + pos, run);
+        }
+        pos += run;
+      } else {
+        if (partial.len > 0) {
+          ok = count_span(wclist, partial.data, partial.len);
+          partial.len = 0;
+        }
+        if (rest == 0)
+          break;
+        pos += __builtin_ctzll(rest);
+      }
+    }
+  }
+  if (ok && partial.len > 0)
+    ok = count_span(wclist, partial.data, partial.len);
+
+  if (partial.data != partial.inline_data)
+    free(partial.data);
+  return ok;
+}
+
+size_t complete_words(const char* data, size_t size) {
+  size_t end = size;
+  while (end > 0 && isalpha((unsigned char)data[end - 1]))
+    end--;
+  return end;
+}
+
+bool count_words_fd(word_count_list_t* wclist, int fd) {
+  size_t capacity = READ_SIZE;
+  size_t len = 0;
+  char* buf = malloc(capacity);
+  bool ok = buf != NULL;
+  while (ok) {
+    ssize_t n = read(fd, buf + len, capacity - len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      ok = n == 0;
+      break;
+    }
+    len += n;
+    size_t end = complete_words(buf, len);
+    if (end == 0 && len == capacity) {
+      /* A word longer than the buffer. */
+      char* grown = realloc(buf, capacity * 2);
+      ok = grown != NULL;
+      buf = grown ? grown : buf;
+      capacity *= 2;
+      continue;
+    }
+    ok = count_words_mem(wclist, buf, end);
+    memmove(buf, buf + end, len - end);
+    len -= end;
+  }
+  if (ok && len > 0)
+    ok = count_words_mem(wclist, buf, len);
+  free(buf);
+  return ok;
+}
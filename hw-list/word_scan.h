@@ -0,0 +1,32 @@
+/*
+ * The word_scan interface counts the words in a buffer in memory, finding
+ * and lowercasing them many bytes at a time. It finds the same words as
+ * count_words(): runs of at least two letters.
+ */
+
+#ifndef WORD_SCAN_H
+#define WORD_SCAN_H
+
+#include "word_count.h"
+
+/*
+ * Adds each word in the size bytes at data to a word count list. Returns
+ * false if out of memory.
+ */
+bool count_words_mem(word_count_list_t* wclist, const char* data, size_t size);
+
+/*
+ * Adds each word read from fd, until end of file, to a word count list. The
+ * input is read and scanned a block at a time, with a word cut off at the
+ * end of a block carried over to the next. Returns false on a read error or
+ * if out of memory.
+ */
+bool count_words_fd(word_count_list_t* wclist, int fd);
+
+/*
+ * Returns the length of the prefix of the size bytes at data that ends
+ * between words, leaving out a word that may continue past the end.
+ */
+size_t complete_words(const char* data, size_t size);
+
+#endif /* WORD_SCAN_H */
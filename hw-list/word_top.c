@@ -0,0 +1,89 @@
+/*
+ * Implementation of the word_top interface.
+ *
+ * A min-heap under the comparator holds the k greatest word counts seen so
+ * far, so each word costs one compare against the root and, if it gets in,
+ * O(log k) to sift down. Selecting from n words is O(n log k); the k
+ * survivors are then heap-sorted.
+ */
+
+#include "word_top.h"
+
+typedef struct {
+  word_count_t** items;
+  size_t size;
+  size_t k;
+  bool (*less)(const word_count_t*, const word_count_t*);
+} heap_t;
+
+static void swap(word_count_t** a, word_count_t** b) {
+  word_count_t* tmp = *a;
+  *a = *b;
+  *b = tmp;
+}
+
+/* Restores the heap below I, which may be greater than its children. */
+static void sift_down(heap_t* heap, size_t i) {
+  for (;;) {
+    size_t least = i;
+    size_t left = 2 * i + 1;
+    size_t right = left + 1;
+    if (left < heap->size && heap->less(heap->items[left], heap->items[least]))
+      least = left;
+    if (right < heap->size && heap->less(heap->items[right], heap->items[least]))
+      least = right;
+    if (least == i)
+      return;
+    swap(&heap->items[i], &heap->items[least]);
+    i = least;
+  }
+}
+
+static void sift_up(heap_t* heap, size_t i) {
+  while (i > 0) {
+    size_t parent = (i - 1) / 2;
+    if (!heap->less(heap->items[i], heap->items[parent]))
+      return;
+    swap(&heap->items[i], &heap->items[parent]);
+    i = parent;
+  }
+}
+
+static void offer(word_count_t* wc, void* aux) {
+  heap_t* heap = aux;
+  if (heap->size < heap->k) {
+    heap->items[heap->size++] = wc;
+    sift_up(heap, heap->size - 1);
+  } else if (heap->less(heap->items[0], wc)) {
+    heap->items[0] = wc;
+    sift_down(heap, 0);
+  }
+}
+
+size_t top_words(word_count_list_t* wclist, size_t k,
+                 bool less(const word_count_t*, const word_count_t*), word_count_t** out) {
+  heap_t heap = {out, 0, k, less};
+  for_each_word(wclist, offer, &heap);
+
+  /* Popping the least to the back leaves the greatest first. */
+  size_t n = heap.size;
+  while (heap.size > 1) {
+    swap(&heap.items[0], &heap.items[--heap.size]);
+    sift_down(&heap, 0);
+  }
+  for (size_t i = 0; i < n / 2; i++)
+    swap(&out[i], &out[n - 1 - i]);
+  return n;
+}
+
+bool fprint_top_words(word_count_list_t* wclist, size_t k,
+                      bool less(const word_count_t*, const word_count_t*), FILE* outfile) {
+  word_count_t** top = malloc(k * sizeof(word_count_t*));
+  if (top == NULL && k > 0)
+    return false;
+  size_t n = top_words(wclist, k, less, top);
+  for (size_t i = 0; i < n; i++)
+    fprintf(outfile, "%i\t%s\n", top[i]->count, top[i]->word);
+  free(top);
+  return true;
+}
@@ -0,0 +1,27 @@
+/*
+ * The word_top interface reports the most frequent words in a word count
+ * list without sorting all of it.
+ */
+
+#ifndef WORD_TOP_H
+#define WORD_TOP_H
+
+#include "word_count.h"
+
+/*
+ * Sets out[0..n) to the n = min(k, length) word counts that sort last under
+ * less, in increasing order, and returns n. The entries are only valid while
+ * the list is unchanged.
+ */
+size_t top_words(word_count_list_t* wclist, size_t k,
+                 bool less(const word_count_t*, const word_count_t*), word_count_t** out);
+
+/*
+ * Prints the k word counts that sort last under less, in the order that
+ * wordcount_sort() and fprint_words() would print them, keeping the
+ * candidates in a k-entry heap. Returns false if out of memory.
+ */
+bool fprint_top_words(word_count_list_t* wclist, size_t k,
+                      bool less(const word_count_t*, const word_count_t*), FILE* outfile);
+
+#endif /* WORD_TOP_H */
@@ -1,26 +1,1215 @@
 /*
  * mm_alloc.c
+ *
+ * A thread-safe segregated-fit allocator.
+ *
+ * Every block starts with a one-word header holding its size and three
+ * flags: whether the block is in use, whether the block right before it is,
+ * and whether it belongs to a secondary arena. Free blocks also repeat their
+ * size in a footer (a boundary tag) and sit on one of NUM_CLASSES free lists
+ * chosen by size. A bitmap records which lists are non-empty. Finding a fit,
+ * splitting, and coalescing with both neighbours therefore take constant
+ * time no matter how many blocks the heap holds.
+ *
+ *   allocated:  [ size|flags | payload ...                          ]
+ *   free:       [ size|flags | next | prev | ...           | size   ]
+ *
+ * Built with MM_BEST_FIT (make BEST_FIT=1), the blocks of each large class
+ * form a treap ordered by size and then address instead of a list, and
+ * every allocation gets the smallest, lowest free block that fits rather
+ * than the first of a few. The treap links live in the free blocks too,
+ * and a block's heap priority is a hash of its address.
+ *
+ * Memory is split into arenas, each with its own lock and free lists.
+ * Threads are assigned to arenas round-robin. The main arena grows the sbrk
+ * heap, which is bracketed by an epilogue header (size 0, in use); if
+ * something else moves the program break, the heap simply continues in a
+ * new region whose first block is marked as having an in-use predecessor.
+ * Secondary arenas carve their blocks out of ARENA_HEAP_SIZE-aligned mmap
+ * heaps, so the owner of any block is found by masking its address.
+ *
+ * On top of the arenas, every thread caches a few freed small blocks per
+ * size class and serves mallocs of those sizes without taking any lock.
+ * A block freed by a thread of another arena whose lock is busy is pushed
+ * onto that arena's lock-free remote-free stack, which the arena drains the
+ * next time it is locked.
+ *
+ * Requests for more than 16-byte alignment take a block with room for
+ * the alignment and split off the free space in front of the aligned
+ * payload as a block of its own, so little more than the padding is lost.
+ *
+ * Requests of at least the mmap threshold (see mm_mallopt) bypass the
+ * arenas and get a private mapping of their own, flagged MMAPPED, whose
+ * header holds the mapping length and is preceded by its offset into the
+ * mapping. Freeing such a block unmaps it, and
+ * resizing it is a single mremap, so the kernel moves the pages instead of
+ * copying them.
+ *
+ * Freed memory goes back to the OS in two ways. When the free block at the
+ * top of the sbrk heap grows past the trim threshold, the break is moved
+ * back down, keeping a pad for the next allocations. Inside the heaps, a
+ * free block of at least the release threshold counts the bytes freed into
+ * it, and once they add up to a quarter of the threshold, every page that
+ * lies wholly inside it is released with madvise(MADV_DONTNEED). Batching
+ * keeps churn next to a large free block from making a system call on
+ * every free.
+ *
+ * With MM_HUGEPAGES set, heaps are marked MADV_HUGEPAGE so the kernel can
+ * back them with transparent huge pages, which cuts TLB misses on large
+ * heaps. The sbrk heap then grows a huge page at a time, and memory is only
+ * given back in whole huge pages, so that none gets split.
+ *
+ * Each arena counts its free bytes and its blocks in use per size class
+ * under its own lock; bytes in use and mapped are kept in global counters
+ * for mm_stats(). Blocks in thread caches count as in use. mm_malloc also
+ * feeds the sampling profiler in mm_profile.c when it is running.
  */
 
+#define _GNU_SOURCE
+
 #include "mm_alloc.h"
 
+#include <errno.h>
+#include "mm_pages.h"
+#include "mm_profile.h"
+
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
 
+#define ALIGNMENT 16
+#define WORD_SIZE sizeof(size_t)
+#define MIN_BLOCK_SIZE 32
+#define HEAP_CHUNK_SIZE (64 * 1024)
+
+/* Transparent huge page size assumed by MM_HUGEPAGES. */
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+#define BLOCK_ALLOC 0x1
+#define BLOCK_PREV_ALLOC 0x2
+#define BLOCK_NON_MAIN 0x4
+#define BLOCK_MMAPPED 0x8
+#define BLOCK_FLAGS ((size_t)ALIGNMENT - 1)
+
+/*
+ * Size classes: one class per 16-byte size up to SMALL_MAX, then one class
+ * per power of two. A list in a small class only holds blocks of exactly
+ * that size; a list in a large class holds blocks in [2^k, 2^(k+1)).
+ */
+#define SMALL_MAX 1024
+#define SMALL_MAX_LOG2 10
+#define SMALL_CLASSES ((SMALL_MAX - MIN_BLOCK_SIZE) / ALIGNMENT + 1)
+#define NUM_CLASSES 128
+
+#if NUM_CLASSES != MM_STATS_CLASSES
+#error "mm_stats() reports every size class"
+#endif
+
+/* Blocks of a large class inspected before moving to a larger class. */
+#define FIT_SCAN_LIMIT 8
+
+#ifdef MM_BEST_FIT
+#define BEST_FIT 1
+#else
+#define BEST_FIT 0
+#endif
+
+/* Default for MM_MMAP_THRESHOLD. */
+#define DEFAULT_MMAP_THRESHOLD (128 * 1024)
+
+/* Defaults for MM_TRIM_THRESHOLD and MM_RELEASE_THRESHOLD. */
+#define DEFAULT_TRIM_THRESHOLD (128 * 1024)
+#define DEFAULT_RELEASE_THRESHOLD (256 * 1024)
+
+/* Offset of the header of an MMAPPED block into its mapping, unless it is over-aligned. */
+#define MMAP_OFFSET (ALIGNMENT - WORD_SIZE)
+
+/* Bytes an arena allocates or frees before updating the global in_use count. */
+#define STATS_BATCH (64 * 1024)
+
+/* Arenas are created per online CPU, up to MAX_ARENAS. */
+#define MAX_ARENAS 64
+#define ARENAS_PER_CPU 2
+
+/*
+ * Size and alignment of the mmap heaps of secondary arenas. The heaps are
+ * mapped with MAP_NORESERVE, so untouched pages cost nothing.
+ */
+#define ARENA_HEAP_SIZE ((size_t)64 << 20)
+
+/* Largest block a secondary arena can hold; bigger ones come from the main arena. */
+#define ARENA_MAX_BLOCK (ARENA_HEAP_SIZE - 2 * ALIGNMENT)
+
+/* Thread caches hold blocks of up to TCACHE_MAX_BLOCK bytes, TCACHE_BIN_LIMIT per size. */
+#define TCACHE_MAX_BLOCK 512
+#define TCACHE_BINS ((TCACHE_MAX_BLOCK - MIN_BLOCK_SIZE) / ALIGNMENT + 1)
+#define TCACHE_BIN_LIMIT 32
+
+/* Blocks handed to an empty thread cache bin per trip to the arena. */
+#define TCACHE_REFILL 8
+
+typedef struct block {
+  size_t header;
+  /* The fields below are only valid while the block is free. Blocks in a
+   * thread cache or on a remote-free stack are still marked in use and only
+   * use `next`. */
+  struct block* next;
+  struct block* prev;
+  /* Only valid in free blocks of at least DIRTY_MIN_BLOCK bytes: bytes of
+   * the block that may be resident, that is, all of it except pages
+   * released since it was last coalesced or split. */
+  size_t dirty;
+  /* Only valid in free blocks of a large class under MM_BEST_FIT: children
+   * in the class's treap. */
+  struct block* left;
+  struct block* right;
+} block_t;
+
+typedef struct arena {
+  pthread_mutex_t lock;
+  block_t* free_lists[NUM_CLASSES];
+  uint64_t nonempty_classes[NUM_CLASSES / 64];
+  block_t* remote_frees; // Lock-free stack of blocks freed by other threads.
+  size_t free_bytes;
+  size_t class_blocks[NUM_CLASSES]; // Blocks in use, by size class.
+  long in_use_delta; // Change to in_use not yet added to the global count.
+} __attribute__((aligned(64))) arena_t;
+
+/* Start of every secondary arena heap. */
+typedef struct heap {
+  arena_t* arena;
+} heap_t;
+
+typedef struct tcache {
+  block_t* bins[TCACHE_BINS];
+  unsigned int counts[TCACHE_BINS];
+  arena_t* arena;
+  int disabled; // Set once the thread's exit has flushed the cache.
+  unsigned int unsampled; // Allocations since the profiler last sampled one.
+} tcache_t;
+
+/* Smallest free block with room for `dirty` clear of its footer. */
+#define DIRTY_MIN_BLOCK (sizeof(block_t) + WORD_SIZE)
+
+static arena_t arenas[MAX_ARENAS] = {[0 ... MAX_ARENAS - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER}};
+static arena_t* const main_arena = &arenas[0];
+static unsigned int num_arenas = 1;
+static unsigned int next_arena;
+
+static size_t mmap_threshold = DEFAULT_MMAP_THRESHOLD;
+static size_t trim_threshold = DEFAULT_TRIM_THRESHOLD;
+static size_t release_threshold = DEFAULT_RELEASE_THRESHOLD;
+static int hugepages;
+
+static __thread tcache_t tcache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+
+/* Address just past the epilogue header, or NULL before the first sbrk. */
+static char* heap_end;
+
+/* Statistics. heap_bytes is protected by the main arena lock; the rest are atomic. */
+static size_t heap_bytes;    // Bytes between the initial and the current break.
+static size_t pages_bytes;   // Bytes from mm_pages_alloc().
+static size_t mmapped_bytes; // Bytes of MMAPPED blocks.
+static size_t mmapped_blocks;
+static size_t in_use;
+static size_t peak_in_use;
+
+static inline size_t block_size(block_t* block) { return block->header & ~BLOCK_FLAGS; }
+
+static inline int block_is_alloc(block_t* block) { return block->header & BLOCK_ALLOC; }
+
+static inline int block_is_mmapped(block_t* block) { return block->header & BLOCK_MMAPPED; }
+
+/* Offset of MMAPPED BLOCK into its mapping, stored in the word before it. */
+static inline size_t mmap_offset(block_t* block) { return *((size_t*)block - 1); }
+
+/* Bytes of BLOCK available to the caller. */
+static inline size_t block_usable_size(block_t* block) {
+  if (block_is_mmapped(block))
+    return block_size(block) - mmap_offset(block) - WORD_SIZE;
+  return block_size(block) - WORD_SIZE;
+}
+
+/* Flags a header rewrite must keep. */
+static inline size_t block_kept_flags(block_t* block) {
+  return block->header & (BLOCK_PREV_ALLOC | BLOCK_NON_MAIN);
+}
+
+static inline block_t* next_block(block_t* block) {
+  return (block_t*)((char*)block + block_size(block));
+}
+
+/* Only valid when the previous block is free, i.e. has a footer. */
+static inline block_t* prev_block(block_t* block) {
+  size_t prev_size = *((size_t*)block - 1);
+  return (block_t*)((char*)block - prev_size);
+}
+
+static inline void* block_payload(block_t* block) { return (char*)block + WORD_SIZE; }
+
+static inline block_t* payload_block(void* ptr) { return (block_t*)((char*)ptr - WORD_SIZE); }
+
+static inline arena_t* block_arena(block_t* block) {
+  if (!(block->header & BLOCK_NON_MAIN))
+    return main_arena;
+  return ((heap_t*)((uintptr_t)block & ~(ARENA_HEAP_SIZE - 1)))->arena;
+}
+
+static inline size_t align_up(size_t n, size_t alignment) {
+  return (n + alignment - 1) & ~(alignment - 1);
+}
+
+static inline size_t align_down(size_t n, size_t alignment) { return n & ~(alignment - 1); }
+
+/* Block size needed to serve a request of SIZE bytes, or 0 on overflow. */
+static inline size_t request_block_size(size_t size) {
+  if (size > SIZE_MAX / 2)
+    return 0;
+  size_t block_size = align_up(size + WORD_SIZE, ALIGNMENT);
+  return block_size < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : block_size;
+}
+
+static inline int size_class(size_t size) {
+  if (size <= SMALL_MAX)
+    return (size - MIN_BLOCK_SIZE) / ALIGNMENT;
+  int log2 = 63 - __builtin_clzll(size);
+  return SMALL_CLASSES + log2 - SMALL_MAX_LOG2;
+}
+
+static void add_in_use(size_t bytes) {
+  size_t total = __atomic_add_fetch(&in_use, bytes, __ATOMIC_RELAXED);
+  size_t peak = __atomic_load_n(&peak_in_use, __ATOMIC_RELAXED);
+  while (total > peak && !__atomic_compare_exchange_n(&peak_in_use, &peak, total, 1,
+                                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+static void sub_in_use(size_t bytes) { __atomic_sub_fetch(&in_use, bytes, __ATOMIC_RELAXED); }
+
+/* Adds the pending in_use change of ARENA, whose lock is held, to the global count. */
+static void flush_in_use(arena_t* arena) {
+  if (arena->in_use_delta > 0)
+    add_in_use(arena->in_use_delta);
+  else
+    sub_in_use(-arena->in_use_delta);
+  arena->in_use_delta = 0;
+}
+
+/*
+ * Counts BLOCK of ARENA, whose lock is held, as handed out or given back.
+ * The global count is only updated every STATS_BATCH bytes, which keeps
+ * atomics off the common path and the peak accurate to within a batch per
+ * arena.
+ */
+static void count_alloc(arena_t* arena, block_t* block) {
+  arena->class_blocks[size_class(block_size(block))]++;
+  arena->in_use_delta += block_size(block);
+  if (arena->in_use_delta > STATS_BATCH)
+    flush_in_use(arena);
+}
+
+static void count_free(arena_t* arena, block_t* block) {
+  arena->class_blocks[size_class(block_size(block))]--;
+  arena->in_use_delta -= block_size(block);
+  if (arena->in_use_delta < -STATS_BATCH)
+    flush_in_use(arena);
+}
+
+/* Smallest non-empty class of ARENA at or above CLASS, or -1 if there is none. */
+static int next_nonempty_class(arena_t* arena, int class) {
+  for (int word = class / 64; word < NUM_CLASSES / 64; word++) {
+    uint64_t bits = arena->nonempty_classes[word];
+    if (word == class / 64)
+      bits &= ~0ULL << (class % 64);
+    if (bits != 0)
+      return word * 64 + __builtin_ctzll(bits);
+  }
+  return -1;
+}
+
+/* Whether the free blocks of CLASS form a treap rather than a list. */
+static inline int class_is_tree(int class) { return BEST_FIT && class >= SMALL_CLASSES; }
+
+static inline uint64_t treap_priority(block_t* block) {
+  return (uintptr_t)block * 0x9e3779b97f4a7c15ULL;
+}
+
+/* Treap order: by size, then by address. */
+static inline int treap_less(block_t* a, block_t* b) {
+  return block_size(a) < block_size(b) || (block_size(a) == block_size(b) && a < b);
+}
+
+/*
+ * Inserts BLOCK into the treap at *LINK: walks down to where BLOCK's
+ * priority belongs and splits the subtree there into its children.
+ */
+static void treap_insert(block_t** link, block_t* block) {
+  uint64_t priority = treap_priority(block);
+  while (*link != NULL && treap_priority(*link) > priority)
+    link = treap_less(block, *link) ? &(*link)->left : &(*link)->right;
+
+  block_t* node = *link;
+  block_t** left = &block->left;
+  block_t** right = &block->right;
+  while (node != NULL) {
+    if (treap_less(node, block)) {
+      *left = node;
+      left = &node->right;
+      node = node->right;
+    } else {
+      *right = node;
+      right = &node->left;
+      node = node->left;
+    }
+  }
+  *left = *right = NULL;
+  *link = block;
+}
+
+/* Removes BLOCK from the treap at *LINK by merging its children in its place. */
+static void treap_remove(block_t** link, block_t* block) {
+  while (*link != block)
+    link = treap_less(block, *link) ? &(*link)->left : &(*link)->right;
+
+  block_t* left = block->left;
+  block_t* right = block->right;
+  while (left != NULL && right != NULL) {
+    if (treap_priority(left) > treap_priority(right)) {
+      *link = left;
+      link = &left->right;
+      left = left->right;
+    } else {
+      *link = right;
+      link = &right->left;
+      right = right->left;
+    }
+  }
+  *link = left != NULL ? left : right;
+}
+
+/* Smallest block of the treap at NODE of at least SIZE bytes, lowest first among equals. */
+static block_t* treap_best_fit(block_t* node, size_t size) {
+  block_t* best = NULL;
+  while (node != NULL) {
+    if (block_size(node) >= size) {
+      best = node;
+      node = node->left;
+    } else {
+      node = node->right;
+    }
+  }
+  return best;
+}
+
+static void insert_free(arena_t* arena, block_t* block) {
+  int class = size_class(block_size(block));
+  arena->nonempty_classes[class / 64] |= 1ULL << (class % 64);
+  arena->free_bytes += block_size(block);
+  if (class_is_tree(class)) {
+    treap_insert(&arena->free_lists[class], block);
+    return;
+  }
+  block->prev = NULL;
+  block->next = arena->free_lists[class];
+  if (block->next != NULL)
+    block->next->prev = block;
+  arena->free_lists[class] = block;
+}
+
+static void remove_free(arena_t* arena, block_t* block) {
+  int class = size_class(block_size(block));
+  if (class_is_tree(class)) {
+    treap_remove(&arena->free_lists[class], block);
+  } else {
+    if (block->prev != NULL)
+      block->prev->next = block->next;
+    else
+      arena->free_lists[class] = block->next;
+    if (block->next != NULL)
+      block->next->prev = block->prev;
+  }
+  if (arena->free_lists[class] == NULL)
+    arena->nonempty_classes[class / 64] &= ~(1ULL << (class % 64));
+  arena->free_bytes -= block_size(block);
+}
+
+/*
+ * Marks BLOCK as free with the given SIZE: writes its header (keeping the
+ * PREV_ALLOC and NON_MAIN flags) and footer, and tells the next block.
+ * Space that was in use, split off or just mapped counts as wholly dirty.
+ */
+static void set_free(block_t* block, size_t size) {
+  block->header = size | block_kept_flags(block);
+  *(size_t*)((char*)block + size - WORD_SIZE) = size;
+  next_block(block)->header &= ~BLOCK_PREV_ALLOC;
+  if (size >= DIRTY_MIN_BLOCK)
+    block->dirty = size;
+}
+
+/*
+ * Merges free BLOCK, which is on no free list, with its free neighbours and
+ * puts the result on the right free list of ARENA. Returns the merged block.
+ */
+static block_t* coalesce(arena_t* arena, block_t* block) {
+  size_t size = block_size(block);
+
+  block_t* next = next_block(block);
+  if (!block_is_alloc(next)) {
+    remove_free(arena, next);
+    size += block_size(next);
+  }
+  if (!(block->header & BLOCK_PREV_ALLOC)) {
+    block = prev_block(block);
+    remove_free(arena, block);
+    size += block_size(block);
+  }
+
+  set_free(block, size);
+  insert_free(arena, block);
+  return block;
+}
+
+static inline int use_hugepages(void) { return __atomic_load_n(&hugepages, __ATOMIC_RELAXED); }
+
+/* Smallest step in which the sbrk heap grows. */
+static size_t heap_chunk_size(void) {
+  return use_hugepages() ? HUGE_PAGE_SIZE : HEAP_CHUNK_SIZE;
+}
+
+/* Unit in which heap memory is given back to the OS. */
+static size_t release_granule(void) {
+  return use_hugepages() ? HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/*
+ * Asks for huge pages for the pages of [START, START + SIZE), including the
+ * one START is on, which the previous extension left out if it ended midway.
+ * Must come before anything in the range is touched: a huge page is only
+ * used for a range that has no small pages yet.
+ */
+static void advise_hugepages(char* start, size_t size) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  uintptr_t low = align_down((uintptr_t)start, page_size);
+  uintptr_t high = align_down((uintptr_t)start + size, page_size);
+  if (high > low)
+    madvise((void*)low, high - low, MADV_HUGEPAGE);
+}
+
+/*
+ * Rounds SIZE up so that heap space starting at BASE ends on a huge page
+ * boundary when the heap uses huge pages. Otherwise the last huge page would
+ * be touched before it is whole and get small pages.
+ */
+static size_t round_to_huge_page(char* base, size_t size) {
+  if (!use_hugepages())
+    return size;
+  return align_up((uintptr_t)base + size, HUGE_PAGE_SIZE) - (uintptr_t)base;
+}
+
+/*
+ * Grows the sbrk heap of the main arena by at least SIZE bytes and returns
+ * the new space as one free block, coalesced with any free block at the old
+ * end of the heap. Returns NULL if the break cannot be moved.
+ */
+static block_t* extend_heap(size_t size) {
+  char* brk = sbrk(0);
+  if (brk == (char*)-1)
+    return NULL;
+
+  block_t* block;
+  size = align_up(size, ALIGNMENT);
+  if (heap_end != NULL && brk == heap_end) {
+    /* The new block takes over the old epilogue header. */
+    size = round_to_huge_page(heap_end, size);
+    if (sbrk(size) == (void*)-1)
+      return NULL;
+    if (use_hugepages())
+      advise_hugepages(heap_end, size);
+    heap_bytes += size;
+    block = (block_t*)(heap_end - WORD_SIZE);
+    block->header = size | (block->header & BLOCK_PREV_ALLOC);
+  } else {
+    /* Start a new region; payloads must be ALIGNMENT-aligned. */
+    char* start = (char*)align_up((uintptr_t)brk + WORD_SIZE, ALIGNMENT) - WORD_SIZE;
+    size = round_to_huge_page(start + WORD_SIZE, size);
+    if (sbrk(start - brk + size + WORD_SIZE) == (void*)-1)
+      return NULL;
+    if (use_hugepages())
+      advise_hugepages(brk, start - brk + size + WORD_SIZE);
+    heap_bytes += start - brk + size + WORD_SIZE;
+    block = (block_t*)start;
+    block->header = size | BLOCK_PREV_ALLOC;
+  }
+
+  block_t* epilogue = next_block(block);
+  epilogue->header = 0 | BLOCK_ALLOC;
+  heap_end = (char*)epilogue + WORD_SIZE;
+
+  set_free(block, size);
+  return coalesce(main_arena, block);
+}
+
+void* mm_pages_alloc(size_t size, size_t alignment) {
+  /* Over-map so that an aligned run of SIZE bytes fits, then trim. */
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+  char* map = mmap(NULL, size + alignment, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (map == MAP_FAILED)
+    return NULL;
+  char* start = (char*)align_up((uintptr_t)map, alignment);
+  if (start > map)
+    munmap(map, start - map);
+  munmap(start + size, map + alignment - start);
+  __atomic_add_fetch(&pages_bytes, size, __ATOMIC_RELAXED);
+  return start;
+}
+
+void mm_pages_free(void* pages, size_t size) {
+  munmap(pages, size);
+  __atomic_sub_fetch(&pages_bytes, size, __ATOMIC_RELAXED);
+}
+
+/*
+ * Maps a new heap for secondary ARENA and returns its space as one free
+ * block on ARENA's free lists, or NULL if the mapping fails.
+ */
+static block_t* new_arena_heap(arena_t* arena) {
+  char* start = mm_pages_alloc(ARENA_HEAP_SIZE, ARENA_HEAP_SIZE);
+  if (start == NULL)
+    return NULL;
+
+  heap_t* heap = (heap_t*)start;
+  heap->arena = arena;
+  if (use_hugepages())
+    madvise(start, ARENA_HEAP_SIZE, MADV_HUGEPAGE);
+
+  char* first = (char*)align_up((uintptr_t)(heap + 1) + WORD_SIZE, ALIGNMENT) - WORD_SIZE;
+  size_t size = (start + ARENA_HEAP_SIZE - WORD_SIZE - first) & ~BLOCK_FLAGS;
+  block_t* block = (block_t*)first;
+  block->header = size | BLOCK_PREV_ALLOC | BLOCK_NON_MAIN;
+  next_block(block)->header = 0 | BLOCK_ALLOC | BLOCK_NON_MAIN;
+
+  set_free(block, size);
+  insert_free(arena, block);
+  return block;
+}
+
+/* Returns a free block of ARENA of at least SIZE bytes, still on its free list. */
+static block_t* find_fit(arena_t* arena, size_t size) {
+  int class = size_class(size);
+
+  if (class < SMALL_CLASSES) {
+    if (arena->free_lists[class] != NULL)
+      return arena->free_lists[class];
+  } else if (class_is_tree(class)) {
+    block_t* block = treap_best_fit(arena->free_lists[class], size);
+    if (block != NULL)
+      return block;
+  } else {
+    int scanned = 0;
+    for (block_t* block = arena->free_lists[class]; block != NULL && scanned < FIT_SCAN_LIMIT;
+         block = block->next, scanned++) {
+      if (block_size(block) >= size)
+        return block;
+    }
+  }
+
+  /* Every block in a larger class is big enough. */
+  class = next_nonempty_class(arena, class + 1);
+  if (class < 0)
+    return NULL;
+  if (class_is_tree(class))
+    return treap_best_fit(arena->free_lists[class], 0);
+  return arena->free_lists[class];
+}
+
+/*
+ * Allocates the first SIZE bytes of free BLOCK, which is on no free list,
+ * and returns the rest of it to the free lists of ARENA if it is big enough.
+ */
+static void place(arena_t* arena, block_t* block, size_t size) {
+  size_t remaining = block_size(block) - size;
+
+  if (remaining >= MIN_BLOCK_SIZE) {
+    block->header = size | BLOCK_ALLOC | block_kept_flags(block);
+    block_t* rest = next_block(block);
+    rest->header = remaining | BLOCK_PREV_ALLOC | (block->header & BLOCK_NON_MAIN);
+    set_free(rest, remaining);
+    insert_free(arena, rest);
+  } else {
+    block->header |= BLOCK_ALLOC;
+    next_block(block)->header |= BLOCK_PREV_ALLOC;
+  }
+  count_alloc(arena, block);
+}
+
+/*
+ * Takes a free block of at least SIZE bytes off the free lists of ARENA,
+ * whose lock is held, growing the arena if none fits.
+ */
+static block_t* take_fit(arena_t* arena, size_t size) {
+  block_t* block = find_fit(arena, size);
+  if (block == NULL) {
+    size_t chunk = heap_chunk_size();
+    if (arena == main_arena)
+      block = extend_heap(size > chunk ? size : chunk);
+    else
+      block = new_arena_heap(arena);
+    if (block == NULL)
+      return NULL;
+  }
+  remove_free(arena, block);
+  return block;
+}
+
+/* Allocates a block of SIZE bytes from ARENA, whose lock is held. */
+static block_t* arena_malloc(arena_t* arena, size_t size) {
+  block_t* block = take_fit(arena, size);
+  if (block != NULL)
+    place(arena, block, size);
+  return block;
+}
+
+/*
+ * Allocates a block of SIZE bytes whose payload is aligned to ALIGNMENT
+ * from ARENA, whose lock is held. The fit has room for a free block in
+ * front of the first aligned payload; that block goes back on the free
+ * lists and place() returns whatever is left after the allocation.
+ */
+static block_t* arena_memalign(arena_t* arena, size_t size, size_t alignment) {
+  block_t* block = take_fit(arena, size + alignment + MIN_BLOCK_SIZE);
+  if (block == NULL)
+    return NULL;
+
+  uintptr_t payload = (uintptr_t)block_payload(block);
+  if (payload % alignment != 0) {
+    /* Free blocks never border each other, so the gap cannot be merged. */
+    block_t* aligned = payload_block((void*)align_up(payload + MIN_BLOCK_SIZE, alignment));
+    size_t gap = (char*)aligned - (char*)block;
+    aligned->header = (block_size(block) - gap) | (block->header & BLOCK_NON_MAIN);
+    set_free(block, gap);
+    insert_free(arena, block);
+    block = aligned;
+  }
+  place(arena, block, size);
+  return block;
+}
+
+/* Free bytes kept at the top of a heap: enough for any heap allocation. */
+static size_t top_pad(void) {
+  size_t pad = __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED);
+  return pad < HEAP_CHUNK_SIZE ? HEAP_CHUNK_SIZE : pad;
+}
+
+/*
+ * Moves the break back down if free BLOCK, the top of the sbrk heap, is
+ * larger than the trim threshold plus a pad big enough for any heap
+ * allocation.
+ */
+static void trim_heap(block_t* block) {
+  block_t* epilogue = next_block(block);
+  if (block_size(epilogue) != 0 || (char*)epilogue + WORD_SIZE != heap_end)
+    return;
+
+  size_t pad = top_pad();
+  size_t size = block_size(block);
+  if (size <= pad || size - pad < __atomic_load_n(&trim_threshold, __ATOMIC_RELAXED) ||
+      sbrk(0) != heap_end)
+    return;
+
+  size_t release = align_down(size - pad, release_granule());
+  if (release == 0 || sbrk(-(intptr_t)release) == (void*)-1)
+    return;
+  remove_free(main_arena, block);
+  size -= release;
+  heap_end -= release;
+  heap_bytes -= release;
+  block->header = size | block_kept_flags(block);
+  next_block(block)->header = 0 | BLOCK_ALLOC;
+  set_free(block, size);
+  insert_free(main_arena, block);
+}
+
+/* Releases the pages that lie wholly inside free BLOCK, past its first KEEP bytes. */
+static void release_pages(block_t* block, size_t keep) {
+  size_t granule = release_granule();
+  uintptr_t low = align_up((uintptr_t)(block + 1) + keep, granule);
+  uintptr_t high = align_down((uintptr_t)next_block(block) - WORD_SIZE, granule);
+  if (high > low)
+    madvise((void*)low, high - low, MADV_DONTNEED);
+}
+
+/*
+ * Returns BLOCK of ARENA, whose lock is held, to the free lists, and gives
+ * memory back to the OS if the merged block is large enough.
+ */
+static void arena_free(arena_t* arena, block_t* block) {
+  count_free(arena, block);
+  size_t threshold = __atomic_load_n(&release_threshold, __ATOMIC_RELAXED);
+
+  /* Neighbours too small to keep `dirty` count as wholly dirty. */
+  size_t dirty = block_size(block);
+  block_t* next = next_block(block);
+  if (!block_is_alloc(next))
+    dirty += block_size(next) < DIRTY_MIN_BLOCK ? block_size(next) : next->dirty;
+  if (!(block->header & BLOCK_PREV_ALLOC)) {
+    block_t* prev = prev_block(block);
+    dirty += block_size(prev) < DIRTY_MIN_BLOCK ? block_size(prev) : prev->dirty;
+  }
+
+  set_free(block, block_size(block));
+  block = coalesce(arena, block);
+  if (block_size(block) < DIRTY_MIN_BLOCK)
+    return;
+  block->dirty = dirty;
+  if (block_size(block) < threshold)
+    return;
+
+  /* The top of the sbrk heap is trimmed instead. The top of other heaps
+   * keeps a pad resident, like a trimmed heap. */
+  int top = block_size(next_block(block)) == 0;
+  if (top && arena == main_arena) {
+    trim_heap(block);
+    return;
+  }
+  if (dirty >= threshold / 4) {
+    release_pages(block, top ? top_pad() : 0);
+    block->dirty = 0;
+  }
+}
+
+static void push_remote_free(arena_t* arena, block_t* block) {
+  block_t* head = __atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED);
+  do {
+    block->next = head;
+  } while (!__atomic_compare_exchange_n(&arena->remote_frees, &head, block, 1, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED));
+}
+
+/*
+ * Frees every block on the remote-free stack of ARENA, whose lock is held.
+ * The whole stack is taken at once, so popping never races with a push.
+ */
+static void drain_remote_frees(arena_t* arena) {
+  if (__atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED) == NULL)
+    return;
+  block_t* block = __atomic_exchange_n(&arena->remote_frees, NULL, __ATOMIC_ACQUIRE);
+  while (block != NULL) {
+    block_t* next = block->next;
+    arena_free(arena, block);
+    block = next;
+  }
+}
+
+static void lock_arena(arena_t* arena) {
+  pthread_mutex_lock(&arena->lock);
+  drain_remote_frees(arena);
+}
+
+static void unlock_arena(arena_t* arena) { pthread_mutex_unlock(&arena->lock); }
+
+/*
+ * Frees BLOCK into its own arena. If that is not the calling thread's arena
+ * and it is busy, the block goes on the arena's remote-free stack instead
+ * of waiting for the lock.
+ */
+static void free_block(block_t* block) {
+  arena_t* arena = block_arena(block);
+  if (arena != tcache.arena) {
+    if (pthread_mutex_trylock(&arena->lock) != 0) {
+      push_remote_free(arena, block);
+      return;
+    }
+    drain_remote_frees(arena);
+  } else {
+    lock_arena(arena);
+  }
+  arena_free(arena, block);
+  unlock_arena(arena);
+}
+
+/* Empties the thread cache of an exiting thread back into the arenas. */
+static void flush_tcache(void* unused) {
+  (void)unused;
+  tcache.disabled = 1;
+  for (int bin = 0; bin < TCACHE_BINS; bin++) {
+    block_t* block = tcache.bins[bin];
+    while (block != NULL) {
+      block_t* next = block->next;
+      free_block(block);
+      block = next;
+    }
+    tcache.bins[bin] = NULL;
+    tcache.counts[bin] = 0;
+  }
+}
+
+/*
+ * fork() handlers. Every arena lock is held across the fork so that the
+ * child never inherits a heap that another thread was halfway through
+ * changing. Locks are always taken in index order.
+ */
+static void lock_all_arenas(void) {
+  for (int i = 0; i < MAX_ARENAS; i++)
+    pthread_mutex_lock(&arenas[i].lock);
+}
+
+static void unlock_all_arenas(void) {
+  for (int i = MAX_ARENAS - 1; i >= 0; i--)
+    pthread_mutex_unlock(&arenas[i].lock);
+}
+
+static void init_arenas(void) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpus > 0)
+    num_arenas = cpus * ARENAS_PER_CPU < MAX_ARENAS ? cpus * ARENAS_PER_CPU : MAX_ARENAS;
+  pthread_key_create(&tcache_key, flush_tcache);
+  pthread_atfork(lock_all_arenas, unlock_all_arenas, unlock_all_arenas);
+}
+
+/* The arena of the calling thread, assigned round-robin on first use. */
+static arena_t* thread_arena(void) {
+  if (tcache.arena == NULL) {
+    pthread_once(&tcache_once, init_arenas);
+    unsigned int index = __atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED);
+    tcache.arena = &arenas[index % num_arenas];
+    pthread_setspecific(tcache_key, &tcache);
+  }
+  return tcache.arena;
+}
+
+/*
+ * Maps a block of SIZE bytes whose payload is aligned to ALIGNMENT. The
+ * mapping has room for the payload to be moved up to the next boundary.
+ */
+static block_t* mmap_block(size_t size, size_t alignment) {
+  size_t slack = alignment > ALIGNMENT ? alignment : 0;
+  size_t length = align_up(size + MMAP_OFFSET + slack, sysconf(_SC_PAGESIZE));
+  char* map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED)
+    return NULL;
+  char* payload = (char*)align_up((uintptr_t)map + MMAP_OFFSET + WORD_SIZE, alignment);
+  block_t* block = payload_block(payload);
+  *((size_t*)block - 1) = (char*)block - map;
+  block->header = length | BLOCK_ALLOC | BLOCK_MMAPPED;
+  __atomic_add_fetch(&mmapped_bytes, length, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&mmapped_blocks, 1, __ATOMIC_RELAXED);
+  add_in_use(length);
+  return block;
+}
+
+static void munmap_block(block_t* block) {
+  size_t length = block_size(block);
+  munmap((char*)block - mmap_offset(block), length);
+  __atomic_sub_fetch(&mmapped_bytes, length, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&mmapped_blocks, 1, __ATOMIC_RELAXED);
+  sub_in_use(length);
+}
+
+/* Resizes MMAPPED BLOCK to hold SIZE bytes, possibly moving it. */
+static block_t* mremap_block(block_t* block, size_t size) {
+  size_t offset = mmap_offset(block);
+  size_t length = align_up(offset + size, sysconf(_SC_PAGESIZE));
+  size_t old_length = block_size(block);
+  if (length == old_length)
+    return block;
+  char* map = mremap((char*)block - offset, old_length, length, MREMAP_MAYMOVE);
+  if (map == MAP_FAILED)
+    return NULL;
+  __atomic_add_fetch(&mmapped_bytes, length - old_length, __ATOMIC_RELAXED);
+  if (length > old_length)
+    add_in_use(length - old_length);
+  else
+    sub_in_use(old_length - length);
+  block = (block_t*)(map + offset);
+  block->header = length | BLOCK_ALLOC | BLOCK_MMAPPED;
+  return block;
+}
+
+int mm_mallopt(int param, int value) {
+  switch (param) {
+    case MM_MMAP_THRESHOLD:
+      if (value < 0)
+        return 0;
+      __atomic_store_n(&mmap_threshold, (size_t)value, __ATOMIC_RELAXED);
+      return 1;
+    case MM_TRIM_THRESHOLD:
+      if (value < 0)
+        return 0;
+      __atomic_store_n(&trim_threshold, (size_t)value, __ATOMIC_RELAXED);
+      return 1;
+    case MM_RELEASE_THRESHOLD:
+      if (value < 0)
+        return 0;
+      __atomic_store_n(&release_threshold, (size_t)value, __ATOMIC_RELAXED);
+      return 1;
+    case MM_HUGEPAGES:
+      __atomic_store_n(&hugepages, value != 0, __ATOMIC_RELAXED);
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/* Hands one in mm_profile_rate allocations to the profiler. */
+static inline void sample_allocation(size_t size) {
+  unsigned int rate = __atomic_load_n(&mm_profile_rate, __ATOMIC_RELAXED);
+  if (rate != 0 && ++tcache.unsampled >= rate) {
+    tcache.unsampled = 0;
+    mm_profile_record(size);
+  }
+}
+
 void* mm_malloc(size_t size) {
-  //TODO: Implement malloc
+  if (size == 0)
+    return NULL;
+  size_t asize = request_block_size(size);
+  if (asize == 0)
+    return NULL;
+
+  sample_allocation(size);
+
+  if (asize >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED)) {
+    block_t* block = mmap_block(asize, ALIGNMENT);
+    return block == NULL ? NULL : block_payload(block);
+  }
 
-  return NULL;
+  int cached = asize <= TCACHE_MAX_BLOCK && !tcache.disabled;
+  int bin = cached ? size_class(asize) : 0;
+  if (cached && tcache.bins[bin] != NULL) {
+    block_t* block = tcache.bins[bin];
+    tcache.bins[bin] = block->next;
+    tcache.counts[bin]--;
+    return block_payload(block);
+  }
+
+  arena_t* arena = thread_arena();
+  if (asize > ARENA_MAX_BLOCK)
+    arena = main_arena;
+  lock_arena(arena);
+  block_t* block = arena_malloc(arena, asize);
+  if (block != NULL && cached) {
+    /* Take a few more blocks of this size while the lock is held. */
+    for (int i = 1; i < TCACHE_REFILL; i++) {
+      block_t* extra = find_fit(arena, asize);
+      if (extra == NULL)
+        break;
+      remove_free(arena, extra);
+      place(arena, extra, asize);
+      extra->next = tcache.bins[bin];
+      tcache.bins[bin] = extra;
+      tcache.counts[bin]++;
+    }
+  }
+  unlock_arena(arena);
+
+  return block == NULL ? NULL : block_payload(block);
+}
+
+/*
+ * Resizes BLOCK of ARENA, whose lock is held, to SIZE bytes without moving
+ * it. Returns whether that was possible.
+ */
+static int resize_in_place(arena_t* arena, block_t* block, size_t size) {
+  size_t old_size = block_size(block);
+
+  /* Shrinking, or growing into a free neighbour, happens in place. A block
+   * at the end of the sbrk heap gets a free neighbour by moving the break. */
+  block_t* next = next_block(block);
+  if (old_size < size && arena == main_arena && block_size(next) == 0 &&
+      (char*)next + WORD_SIZE == heap_end && sbrk(0) == heap_end) {
+    size_t growth = size - old_size;
+    size_t chunk = heap_chunk_size();
+    extend_heap(growth > chunk ? growth : chunk);
+    next = next_block(block);
+  }
+  size_t available = old_size;
+  if (!block_is_alloc(next))
+    available += block_size(next);
+  if (available < size)
+    return 0;
+
+  count_free(arena, block);
+  if (available > old_size) {
+    remove_free(arena, next);
+    block->header = available | BLOCK_ALLOC | block_kept_flags(block);
+    next_block(block)->header |= BLOCK_PREV_ALLOC;
+  }
+  size_t remaining = available - size;
+  if (remaining >= MIN_BLOCK_SIZE) {
+    block->header = size | BLOCK_ALLOC | block_kept_flags(block);
+    block_t* rest = next_block(block);
+    rest->header = remaining | BLOCK_PREV_ALLOC | (block->header & BLOCK_NON_MAIN);
+    set_free(rest, remaining);
+    coalesce(arena, rest);
+  }
+  count_alloc(arena, block);
+  return 1;
+}
+
+void* mm_calloc(size_t count, size_t size) {
+  if (size != 0 && count > SIZE_MAX / size)
+    return NULL;
+  void* ptr = mm_malloc(count * size);
+  /* Fresh mappings are already zeroed. */
+  if (ptr != NULL && !block_is_mmapped(payload_block(ptr)))
+    memset(ptr, 0, count * size);
+  return ptr;
+}
+
+void* mm_memalign(size_t alignment, size_t size) {
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+    return NULL;
+  if (alignment <= ALIGNMENT)
+    return mm_malloc(size);
+  if (size == 0)
+    return NULL;
+  size_t asize = request_block_size(size);
+  if (asize == 0 || asize > SIZE_MAX / 2 - alignment)
+    return NULL;
+
+  sample_allocation(size);
+
+  block_t* block;
+  size_t padded = asize + alignment + MIN_BLOCK_SIZE;
+  if (padded >= __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED)) {
+    block = mmap_block(asize, alignment);
+  } else {
+    arena_t* arena = thread_arena();
+    if (padded > ARENA_MAX_BLOCK)
+      arena = main_arena;
+    lock_arena(arena);
+    block = arena_memalign(arena, asize, alignment);
+    unlock_arena(arena);
+  }
+  return block == NULL ? NULL : block_payload(block);
+}
+
+void* mm_aligned_alloc(size_t alignment, size_t size) { return mm_memalign(alignment, size); }
+
+int mm_posix_memalign(void** ptr, size_t alignment, size_t size) {
+  if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0)
+    return EINVAL;
+  if (size == 0) {
+    *ptr = NULL;
+    return 0;
+  }
+  void* payload = mm_memalign(alignment, size);
+  if (payload == NULL)
+    return ENOMEM;
+  *ptr = payload;
+  return 0;
+}
+
+size_t mm_malloc_usable_size(void* ptr) {
+  return ptr == NULL ? 0 : block_usable_size(payload_block(ptr));
 }
 
 void* mm_realloc(void* ptr, size_t size) {
-  //TODO: Implement realloc
+  if (ptr == NULL)
+    return mm_malloc(size);
+  if (size == 0) {
+    mm_free(ptr);
+    return NULL;
+  }
+  size_t asize = request_block_size(size);
+  if (asize == 0)
+    return NULL;
 
-  return NULL;
+  block_t* block = payload_block(ptr);
+  if (block_is_mmapped(block)) {
+    block = mremap_block(block, asize);
+    return block == NULL ? NULL : block_payload(block);
+  }
+
+  /* Blocks that reach the mmap threshold move out of the heap. */
+  if (asize < __atomic_load_n(&mmap_threshold, __ATOMIC_RELAXED)) {
+    arena_t* arena = block_arena(block);
+    lock_arena(arena);
+    int resized = resize_in_place(arena, block, asize);
+    unlock_arena(arena);
+    if (resized)
+      return ptr;
+  }
+
+  void* new_ptr = mm_malloc(size);
+  if (new_ptr == NULL)
+    return NULL;
+  size_t old_size = block_usable_size(block);
+  memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+  mm_free(ptr);
+  return new_ptr;
 }
 
 void mm_free(void* ptr) {
-  //TODO: Implement free
+  if (ptr == NULL)
+    return;
+  block_t* block = payload_block(ptr);
+  if (block_is_mmapped(block)) {
+    munmap_block(block);
+    return;
+  }
+  size_t size = block_size(block);
+
+  /* Assigning the arena also registers the cache to be flushed at exit. */
+  thread_arena();
+  if (size <= TCACHE_MAX_BLOCK && !tcache.disabled) {
+    int bin = size_class(size);
+    if (tcache.counts[bin] < TCACHE_BIN_LIMIT) {
+      block->next = tcache.bins[bin];
+      tcache.bins[bin] = block;
+      tcache.counts[bin]++;
+      return;
+    }
+  }
+
+  free_block(block);
+}
+
+size_t mm_class_block_size(int class) {
+  if (class < 0 || class >= MM_STATS_CLASSES)
+    return 0;
+  if (class < SMALL_CLASSES)
+    return MIN_BLOCK_SIZE + class * ALIGNMENT;
+  return (size_t)SMALL_MAX << (class - SMALL_CLASSES);
+}
+
+void mm_stats(mm_stats_t* stats) {
+  memset(stats, 0, sizeof(*stats));
+
+  for (int i = 0; i < MAX_ARENAS; i++) {
+    arena_t* arena = &arenas[i];
+    lock_arena(arena);
+    flush_in_use(arena);
+    stats->free += arena->free_bytes;
+    for (int class = NUM_CLASSES - 1; class >= 0; class--) {
+      if (arena->free_lists[class] == NULL)
+        continue;
+      /* The largest block of a treap is on its rightmost path. */
+      for (block_t* block = arena->free_lists[class]; block != NULL;
+           block = class_is_tree(class) ? block->right : block->next) {
+        if (block_size(block) > stats->largest_free)
+          stats->largest_free = block_size(block);
+      }
+      break;
+    }
+    for (int class = 0; class < NUM_CLASSES; class++)
+      stats->class_blocks[class] += arena->class_blocks[class];
+    if (arena == main_arena)
+      stats->mapped += heap_bytes;
+    unlock_arena(arena);
+  }
+
+  stats->mapped += __atomic_load_n(&pages_bytes, __ATOMIC_RELAXED);
+  stats->mapped += __atomic_load_n(&mmapped_bytes, __ATOMIC_RELAXED);
+  stats->mmapped_blocks = __atomic_load_n(&mmapped_blocks, __ATOMIC_RELAXED);
+  stats->in_use = __atomic_load_n(&in_use, __ATOMIC_RELAXED);
+  stats->peak_in_use = __atomic_load_n(&peak_in_use, __ATOMIC_RELAXED);
+  if (stats->free > 0)
+    stats->fragmentation = 1.0 - (double)stats->largest_free / stats->free;
 }
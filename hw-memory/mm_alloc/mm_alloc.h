@@ -11,8 +11,38 @@
 
 #include <stdlib.h>
 
+#include "mm_types.h"
+
 void* mm_malloc(size_t size);
 void* mm_realloc(void* ptr, size_t size);
 void mm_free(void* ptr);
+void* mm_calloc(size_t count, size_t size);
+
+/*
+ * Returns a block of SIZE bytes whose address is a multiple of ALIGNMENT,
+ * a power of two, or NULL. Like memalign(3).
+ */
+void* mm_memalign(size_t alignment, size_t size);
+
+/* Like aligned_alloc(3); the same as mm_memalign(). */
+void* mm_aligned_alloc(size_t alignment, size_t size);
+
+/* Like posix_memalign(3). */
+int mm_posix_memalign(void** ptr, size_t alignment, size_t size);
+
+/* Bytes usable at PTR, which may be more than were asked for. */
+size_t mm_malloc_usable_size(void* ptr);
+
+/* Sets an allocator parameter, like mallopt(3). Returns 1 on success, 0 on error. */
+int mm_mallopt(int param, int value);
+
+/* Fills STATS with a snapshot of the allocator's state. */
+void mm_stats(mm_stats_t* stats);
+
+/*
+ * Lower bound on the block sizes, header included, in size class CLASS, or
+ * 0 if there is no such class.
+ */
+size_t mm_class_block_size(int class);
 
 #endif
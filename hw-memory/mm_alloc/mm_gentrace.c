@@ -0,0 +1,102 @@
+/*
+ * mm_gentrace.c
+ *
+ * Writes a synthetic allocation trace, in the format mm_trace replays, to
+ * standard output. It stands in for programs whose sizes span a wide range,
+ * which the recorded traces in traces/ do not cover.
+ *
+ * Each request is a malloc, a free or, one time in twenty, a realloc of a
+ * live block picked at random. Sizes are log-uniform over 16 B - 64 KiB:
+ * a power of two picked uniformly, plus a uniform offset within it. Mallocs
+ * slightly outnumber frees until MAX_LIVE blocks are live, after which
+ * the live count hovers just under the limit, so the heap grows to a steady
+ * state and then churns.
+ *
+ * The generator has its own pseudo-random number generator, so a SEED gives
+ * the same trace with any C library. `make bench` writes random.trace with
+ * the default seed.
+ *
+ * Usage: mm_gentrace [-s SEED] [-n REQUESTS] [-m MAX_LIVE]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define MIN_SIZE_BITS 4  /* 16 B */
+#define MAX_SIZE_BITS 16 /* 64 KiB */
+
+/* IDs are made up, as addresses 16 bytes apart. */
+#define FIRST_ID 0x10010
+#define ID_STEP 0x10
+
+static uint64_t state;
+
+/* splitmix64: a full-period generator that passes BigCrush. */
+static uint64_t next_random(void) {
+  uint64_t z = (state += 0x9e3779b97f4a7c15);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+/* Returns a value in [0, n), with negligible bias for the n used here. */
+static uint64_t random_below(uint64_t n) { return next_random() % n; }
+
+static size_t random_size(void) {
+  int bits = MIN_SIZE_BITS + random_below(MAX_SIZE_BITS - MIN_SIZE_BITS);
+  return ((size_t)1 << bits) + random_below((size_t)1 << bits);
+}
+
+int main(int argc, char** argv) {
+  uint64_t seed = 1;
+  long requests = 200000;
+  long max_live = 4000;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:n:m:")) != -1) {
+    if (opt == 's') {
+      seed = strtoull(optarg, NULL, 0);
+    } else if (opt == 'n' && atol(optarg) > 0) {
+      requests = atol(optarg);
+    } else if (opt == 'm' && atol(optarg) > 0) {
+      max_live = atol(optarg);
+    } else {
+      fprintf(stderr, "Usage: %s [-s SEED] [-n REQUESTS] [-m MAX_LIVE]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  uint64_t* live = malloc(max_live * sizeof(uint64_t));
+  if (live == NULL) {
+    perror("mm_gentrace");
+    return EXIT_FAILURE;
+  }
+  state = seed;
+  printf("# Synthetic (mm_gentrace -s %llu): %ld requests, sizes log-uniform over 16 B - 64 KiB, "
+         "up to %ld live blocks freed at random, 5%% reallocs\n",
+         (unsigned long long)seed, requests, max_live);
+
+  uint64_t next_id = FIRST_ID;
+  long count = 0;
+  for (long i = 0; i < requests; i++) {
+    uint64_t roll = random_below(100);
+    if (count > 0 && roll < 5) {
+      long victim = random_below(count);
+      printf("r %llx %llx %zu\n", (unsigned long long)live[victim], (unsigned long long)next_id,
+             random_size());
+      live[victim] = next_id;
+      next_id += ID_STEP;
+    } else if (count > 0 && (count == max_live || roll < 50)) {
+      long victim = random_below(count);
+      printf("f %llx\n", (unsigned long long)live[victim]);
+      live[victim] = live[--count];
+    } else {
+      printf("a %llx %zu\n", (unsigned long long)next_id, random_size());
+      live[count++] = next_id;
+      next_id += ID_STEP;
+    }
+  }
+  free(live);
+  return ferror(stdout) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,24 @@
+/*
+ * mm_pages.h
+ *
+ * The page source behind mm_alloc's secondary arenas, shared with the
+ * slab allocator. Not part of the exported interface.
+ */
+
+#pragma once
+
+#ifndef _mm_pages_H_
+#define _mm_pages_H_
+
+#include <stdlib.h>
+
+/*
+ * Maps SIZE bytes aligned to ALIGNMENT, a power of two no smaller than the
+ * page size. Pages are only backed once touched. Returns NULL on failure.
+ */
+void* mm_pages_alloc(size_t size, size_t alignment);
+
+/* Unmaps SIZE bytes at PAGES returned by mm_pages_alloc(). */
+void mm_pages_free(void* pages, size_t size);
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * mm_preload.c
+ *
+ * The C library allocation interface on top of mm_alloc, so that any
+ * dynamically linked program can run on it:
+ *
+ *   LD_PRELOAD=./libmm.so ./program
+ *
+ * Every entry point that hands out or takes back heap memory is replaced,
+ * including the aligned variants, since a block from one allocator must
+ * never reach the other's free(). The library is built with initial-exec
+ * TLS, so the thread caches can be used before the dynamic loader has set
+ * anything up and without __tls_get_addr calling back into malloc.
+ *
+ * Tunables can be set from the environment:
+ *
+ *   MM_MMAP_THRESHOLD, MM_TRIM_THRESHOLD, MM_RELEASE_THRESHOLD
+ *       Bytes; see mm_mallopt().
+ *   MM_HUGEPAGES=1
+ *       Back the heaps with transparent huge pages.
+ *   MM_PROFILE=N
+ *       Sample one in N allocations and write the report to stderr at exit.
+ *   MM_TRACE=PREFIX
+ *       Record every request to PREFIX.PID for replay by mm_trace. Forked
+ *       children stop recording, but a program they exec starts its own file.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "mm_alloc.h"
+#include "mm_profile.h"
+
+static void set_from_environment(const char* name, int param) {
+  char* value = getenv(name);
+  if (value != NULL)
+    mm_mallopt(param, atoi(value));
+}
+
+static void report_profile(void) { mm_profile_report(STDERR_FILENO); }
+
+#define TRACE_BUFFER_SIZE 65536
+#define TRACE_LINE_MAX 64
+
+/* Requests are buffered, since snprintf and write must not allocate. */
+static int trace_fd = -1;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static char trace_buffer[TRACE_BUFFER_SIZE];
+static size_t trace_length;
+
+/* Must be called with trace_lock held. */
+static void flush_trace(void) {
+  size_t written = 0;
+  while (written < trace_length) {
+    ssize_t n = write(trace_fd, trace_buffer + written, trace_length - written);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    written += n;
+  }
+  trace_length = 0;
+}
+
+/*
+ * Appends one request to the trace. Frees are recorded before the block is
+ * given back and allocations after it is handed out, so that the order of
+ * the records matches the order in which addresses were reused.
+ */
+static void trace(const char* format, ...) {
+  int saved_errno = errno;
+  pthread_mutex_lock(&trace_lock);
+  if (trace_fd >= 0) {
+    if (trace_length + TRACE_LINE_MAX > TRACE_BUFFER_SIZE)
+      flush_trace();
+    va_list args;
+    va_start(args, format);
+    trace_length += vsnprintf(trace_buffer + trace_length, TRACE_LINE_MAX, format, args);
+    va_end(args);
+  }
+  pthread_mutex_unlock(&trace_lock);
+  errno = saved_errno;
+}
+
+static void finish_trace(void) {
+  pthread_mutex_lock(&trace_lock);
+  if (trace_fd >= 0)
+    flush_trace();
+  pthread_mutex_unlock(&trace_lock);
+}
+
+static void lock_trace(void) { pthread_mutex_lock(&trace_lock); }
+
+static void unlock_trace(void) { pthread_mutex_unlock(&trace_lock); }
+
+static void stop_trace_in_child(void) {
+  if (trace_fd >= 0)
+    close(trace_fd);
+  trace_fd = -1;
+  trace_length = 0;
+  pthread_mutex_unlock(&trace_lock);
+}
+
+static void start_trace(const char* prefix) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s.%d", prefix, (int)getpid());
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return;
+  pthread_atfork(lock_trace, unlock_trace, stop_trace_in_child);
+  atexit(finish_trace);
+  trace_fd = fd;
+}
+
+__attribute__((constructor)) static void init_from_environment(void) {
+  set_from_environment("MM_MMAP_THRESHOLD", MM_MMAP_THRESHOLD);
+  set_from_environment("MM_TRIM_THRESHOLD", MM_TRIM_THRESHOLD);
+  set_from_environment("MM_RELEASE_THRESHOLD", MM_RELEASE_THRESHOLD);
+  set_from_environment("MM_HUGEPAGES", MM_HUGEPAGES);
+
+  char* rate = getenv("MM_PROFILE");
+  if (rate != NULL && atoi(rate) > 0) {
+    mm_profile_start(atoi(rate));
+    atexit(report_profile);
+  }
+
+  char* prefix = getenv("MM_TRACE");
+  if (prefix != NULL && prefix[0] != '\0')
+    start_trace(prefix);
+}
+
+/* The C library returns a unique pointer for zero-byte requests. */
+void* malloc(size_t size) {
+  void* ptr = mm_malloc(size == 0 ? 1 : size);
+  if (ptr == NULL)
+    errno = ENOMEM;
+  else if (trace_fd >= 0)
+    trace("a %lx %zu\n", (unsigned long)ptr, size);
+  return ptr;
+}
+
+void free(void* ptr) {
+  if (trace_fd >= 0 && ptr != NULL)
+    trace("f %lx\n", (unsigned long)ptr);
+  mm_free(ptr);
+}
+
+void* calloc(size_t count, size_t size) {
+  void* ptr = mm_calloc(count == 0 ? 1 : count, size == 0 ? 1 : size);
+  if (ptr == NULL)
+    errno = ENOMEM;
+  else if (trace_fd >= 0)
+    trace("a %lx %zu\n", (unsigned long)ptr, count * size);
+  return ptr;
+}
+
+void* realloc(void* ptr, size_t size) {
+  if (ptr != NULL && size == 0) {
+    free(ptr);
+    return NULL;
+  }
+  if (ptr == NULL)
+    return malloc(size);
+  void* new_ptr = mm_realloc(ptr, size);
+  if (new_ptr == NULL)
+    errno = ENOMEM;
+  else if (trace_fd >= 0)
+    trace("r %lx %lx %zu\n", (unsigned long)ptr, (unsigned long)new_ptr, size);
+  return new_ptr;
+}
+
+/* Aligned requests are traced as plain mallocs. */
+int posix_memalign(void** ptr, size_t alignment, size_t size) {
+  int error = mm_posix_memalign(ptr, alignment, size == 0 ? 1 : size);
+  if (error == 0 && trace_fd >= 0)
+    trace("a %lx %zu\n", (unsigned long)*ptr, size);
+  return error;
+}
+
+void* memalign(size_t alignment, size_t size) {
+  if (alignment < sizeof(void*))
+    alignment = sizeof(void*);
+  void* ptr = NULL;
+  int error = posix_memalign(&ptr, alignment, size);
+  if (error != 0)
+    errno = error;
+  return ptr;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) { return memalign(alignment, size); }
+
+void* valloc(size_t size) { return memalign(sysconf(_SC_PAGESIZE), size); }
+
+void* pvalloc(size_t size) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  return memalign(page_size, (size + page_size - 1) & ~(page_size - 1));
+}
+
+size_t malloc_usable_size(void* ptr) { return mm_malloc_usable_size(ptr); }
@@ -0,0 +1,223 @@
+/*
+ * mm_profile.c
+ *
+ * Sampling allocation profiler for mm_alloc.
+ *
+ * Sampled stacks live in an open-addressing table keyed by a hash of their
+ * return addresses. The table is mapped directly rather than allocated, so
+ * profiling does not disturb the heap it is measuring, and a thread-local
+ * flag keeps allocations made while taking a backtrace from being sampled
+ * in turn.
+ *
+ * A stack starts at the first frame outside the allocator, so that calloc,
+ * realloc, the aligned variants and the LD_PRELOAD wrappers, which reach
+ * the sampling point through different numbers of frames, all charge the
+ * code that called them.
+ */
+
+#define _GNU_SOURCE
+
+#include "mm_profile.h"
+
+#include <execinfo.h>
+#include <link.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Distinct stacks kept. Must be a power of two. */
+#define PROFILE_SLOTS 4096
+
+/* Frames kept per stack, and most frames skipped inside the allocator. */
+#define PROFILE_DEPTH 16
+#define PROFILE_MAX_SKIP 8
+
+/* Frames skipped (this file and mm_malloc) when the allocator is part of
+ * the program, and its own frames cannot be told apart by address. */
+#define PROFILE_SKIP 2
+
+/* Stacks listed by mm_profile_report(). */
+#define PROFILE_REPORT_MAX 64
+
+#define PROFILE_LINE_MAX 160
+
+typedef struct profile_stack {
+  uint64_t hash; // 0 marks an empty slot.
+  int depth;
+  void* frames[PROFILE_DEPTH];
+  size_t samples;
+  size_t bytes;
+} profile_stack_t;
+
+unsigned int mm_profile_rate;
+
+static profile_stack_t* stacks;
+static unsigned int last_rate;
+static size_t samples;
+static size_t dropped; // Samples lost because the table was full.
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_once_t setup_once = PTHREAD_ONCE_INIT;
+
+/* Code of the shared object that holds the allocator, or empty. */
+static uintptr_t code_start;
+static uintptr_t code_end;
+
+static __thread int recording;
+
+static void lock_profile(void) { pthread_mutex_lock(&profile_lock); }
+
+static void unlock_profile(void) { pthread_mutex_unlock(&profile_lock); }
+
+/* Finds the executable segment holding this file, unless it is in the program itself. */
+static int find_code(struct dl_phdr_info* info, size_t size, void* unused) {
+  (void)size;
+  (void)unused;
+  uintptr_t self = (uintptr_t)mm_profile_record;
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr)* phdr = &info->dlpi_phdr[i];
+    uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+    if (phdr->p_type != PT_LOAD || !(phdr->p_flags & PF_X) || self < start ||
+        self >= start + phdr->p_memsz)
+      continue;
+    if (info->dlpi_name[0] != '\0') {
+      code_start = start;
+      code_end = start + phdr->p_memsz;
+    }
+    return 1;
+  }
+  return 0;
+}
+
+/* Keeps a fork from leaving the table locked in the child, and finds the allocator's code. */
+static void set_up(void) {
+  pthread_atfork(lock_profile, unlock_profile, unlock_profile);
+  dl_iterate_phdr(find_code, NULL);
+}
+
+void mm_profile_start(unsigned int rate) {
+  pthread_once(&setup_once, set_up);
+  pthread_mutex_lock(&profile_lock);
+  if (stacks == NULL) {
+    void* map = mmap(NULL, PROFILE_SLOTS * sizeof(profile_stack_t), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+      pthread_mutex_unlock(&profile_lock);
+      return;
+    }
+    stacks = map;
+  } else {
+    memset(stacks, 0, PROFILE_SLOTS * sizeof(profile_stack_t));
+  }
+  samples = 0;
+  dropped = 0;
+  last_rate = rate;
+  pthread_mutex_unlock(&profile_lock);
+
+  __atomic_store_n(&mm_profile_rate, rate, __ATOMIC_RELAXED);
+}
+
+void mm_profile_stop(void) { __atomic_store_n(&mm_profile_rate, 0, __ATOMIC_RELAXED); }
+
+static uint64_t hash_frames(void** frames, int depth) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (int i = 0; i < depth; i++) {
+    hash ^= (uintptr_t)frames[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash == 0 ? 1 : hash;
+}
+
+void mm_profile_record(size_t size) {
+  if (recording)
+    return;
+  recording = 1;
+
+  void* all_frames[PROFILE_MAX_SKIP + PROFILE_DEPTH];
+  int total = backtrace(all_frames, PROFILE_MAX_SKIP + PROFILE_DEPTH);
+  int skip = 0;
+  if (code_end == 0)
+    skip = PROFILE_SKIP;
+  while (code_end != 0 && skip < total && skip < PROFILE_MAX_SKIP &&
+         (uintptr_t)all_frames[skip] >= code_start && (uintptr_t)all_frames[skip] < code_end)
+    skip++;
+  void** frames = all_frames + skip;
+  int depth = total - skip < PROFILE_DEPTH ? total - skip : PROFILE_DEPTH;
+  if (depth > 0) {
+    uint64_t hash = hash_frames(frames, depth);
+
+    pthread_mutex_lock(&profile_lock);
+    samples++;
+    profile_stack_t* stack = NULL;
+    for (int probe = 0; probe < PROFILE_SLOTS; probe++) {
+      profile_stack_t* slot = &stacks[(hash + probe) & (PROFILE_SLOTS - 1)];
+      if (slot->hash == 0) {
+        slot->hash = hash;
+        slot->depth = depth;
+        memcpy(slot->frames, frames, depth * sizeof(void*));
+        stack = slot;
+        break;
+      }
+      if (slot->hash == hash && slot->depth == depth &&
+          memcmp(slot->frames, frames, depth * sizeof(void*)) == 0) {
+        stack = slot;
+        break;
+      }
+    }
+    if (stack != NULL) {
+      stack->samples++;
+      stack->bytes += size;
+    } else {
+      dropped++;
+    }
+    pthread_mutex_unlock(&profile_lock);
+  }
+
+  recording = 0;
+}
+
+static void write_all(int fd, char* buffer, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(fd, buffer, length);
+    if (written <= 0)
+      return;
+    buffer += written;
+    length -= written;
+  }
+}
+
+static int heavier_stack(const void* a, const void* b) {
+  size_t bytes_a = (*(profile_stack_t**)a)->bytes;
+  size_t bytes_b = (*(profile_stack_t**)b)->bytes;
+  return bytes_a < bytes_b ? 1 : bytes_a > bytes_b ? -1 : 0;
+}
+
+void mm_profile_report(int fd) {
+  static profile_stack_t* sorted[PROFILE_SLOTS];
+  char line[PROFILE_LINE_MAX];
+
+  pthread_mutex_lock(&profile_lock);
+  int count = 0;
+  for (int i = 0; stacks != NULL && i < PROFILE_SLOTS; i++) {
+    if (stacks[i].hash != 0)
+      sorted[count++] = &stacks[i];
+  }
+  qsort(sorted, count, sizeof(sorted[0]), heavier_stack);
+
+  int length = snprintf(line, sizeof(line),
+                        "mm_profile: %zu samples at 1 in %u allocations, %d stacks, %zu dropped\n",
+                        samples, last_rate, count, dropped);
+  write_all(fd, line, length);
+  for (int i = 0; i < count && i < PROFILE_REPORT_MAX; i++) {
+    profile_stack_t* stack = sorted[i];
+    length = snprintf(line, sizeof(line),
+                      "\n#%d: %zu samples, %zu bytes sampled, ~%zu bytes allocated\n", i + 1,
+                      stack->samples, stack->bytes, stack->bytes * last_rate);
+    write_all(fd, line, length);
+    backtrace_symbols_fd(stack->frames, stack->depth, fd);
+  }
+  pthread_mutex_unlock(&profile_lock);
+}
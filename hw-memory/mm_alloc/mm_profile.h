@@ -0,0 +1,35 @@
+/*
+ * mm_profile.h
+ *
+ * Sampling allocation profiler.
+ *
+ * While running, one in every RATE calls to mm_malloc on each thread
+ * records the stack of its caller. Samples with the same stack are merged,
+ * and the report lists stacks by the bytes they asked for, so the call
+ * sites that allocate the most stand out. Link programs with -rdynamic to
+ * get function names in the report.
+ */
+
+#pragma once
+
+#ifndef _mm_profile_H_
+#define _mm_profile_H_
+
+#include <stdlib.h>
+
+/* Clears earlier samples and starts sampling one in RATE allocations. */
+void mm_profile_start(unsigned int rate);
+
+/* Stops sampling. The samples are kept for mm_profile_report(). */
+void mm_profile_stop(void);
+
+/* Writes the sampled stacks, heaviest first, to file descriptor FD. */
+void mm_profile_report(int fd);
+
+/* Sampling rate, or 0 when stopped. Read by mm_malloc. */
+extern unsigned int mm_profile_rate;
+
+/* Records the stack of an allocation of SIZE bytes. Called by mm_malloc. */
+void mm_profile_record(size_t size);
+
+#endif
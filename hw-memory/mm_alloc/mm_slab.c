@@ -0,0 +1,297 @@
+/*
+ * mm_slab.c
+ *
+ * Slab allocator for fixed-size objects on top of mm_alloc's page source.
+ *
+ * Slabs are slab_size-aligned, so the slab of any object is found by
+ * masking its address. Each slab starts with a header and a bitmap with one
+ * set bit per free object; the objects follow.
+ *
+ *   [ slab_t | free_map ... | pad | object 0 | object 1 | ... ]
+ *
+ * A cache keeps its slabs on three lists: partial (some objects free), full
+ * and empty. Allocation takes the first free bit of the first partial slab.
+ * At most SLAB_MAX_EMPTY empty slabs are kept for reuse; the rest go back
+ * to the page source.
+ *
+ * The slab lists are shared and locked, so each thread also keeps a
+ * magazine per cache: a stack of up to SLAB_MAGAZINE_SIZE free objects.
+ * Allocation and free go to the magazine without a lock, and only an empty
+ * or full magazine moves half a magazine of objects to or from the slabs
+ * under the cache lock. A thread's magazines go back to the slabs when it
+ * exits.
+ */
+
+#include "mm_slab.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "mm_alloc.h"
+#include "mm_pages.h"
+
+#define SLAB_MIN_SIZE (64 * 1024)
+#define SLAB_MIN_OBJECTS 8
+#define SLAB_MAX_ALIGN 4096
+#define SLAB_DEFAULT_ALIGN 16
+#define SLAB_MAX_EMPTY 1
+#define SLAB_MAGAZINE_SIZE 64
+
+typedef struct slab {
+  struct slab* next;
+  struct slab* prev;
+  size_t free_count;
+  size_t hint;          // No free object lives in a bitmap word below this one.
+  uint64_t free_map[];  // Bit set: object free.
+} slab_t;
+
+/* One thread's stack of free objects of one cache. */
+typedef struct magazine {
+  struct magazine* next; // In the cache's list of magazines.
+  struct magazine* prev;
+  mm_slab_cache_t* cache;
+  size_t count;
+  void* objects[SLAB_MAGAZINE_SIZE];
+} magazine_t;
+
+struct mm_slab_cache {
+  pthread_mutex_t lock;
+  pthread_key_t magazine_key;
+  int has_key;              // Without a key, every call takes the lock.
+  magazine_t* magazines;
+  size_t stride;            // Object size rounded up to the alignment.
+  size_t slab_size;
+  size_t objects_offset;    // Offset of object 0 from the slab start.
+  size_t objects_per_slab;
+  size_t map_words;
+  slab_t* partial;
+  slab_t* full;
+  slab_t* empty;
+  size_t empty_count;
+};
+
+static inline size_t align_up(size_t n, size_t alignment) {
+  return (n + alignment - 1) & ~(alignment - 1);
+}
+
+static inline size_t map_words(size_t objects) { return (objects + 63) / 64; }
+
+static inline size_t objects_offset(size_t objects, size_t align) {
+  return align_up(sizeof(slab_t) + map_words(objects) * sizeof(uint64_t), align);
+}
+
+static void list_push(slab_t** list, slab_t* slab) {
+  slab->prev = NULL;
+  slab->next = *list;
+  if (*list != NULL)
+    (*list)->prev = slab;
+  *list = slab;
+}
+
+static void list_remove(slab_t** list, slab_t* slab) {
+  if (slab->prev != NULL)
+    slab->prev->next = slab->next;
+  else
+    *list = slab->next;
+  if (slab->next != NULL)
+    slab->next->prev = slab->prev;
+}
+
+static void list_free(mm_slab_cache_t* cache, slab_t* list) {
+  while (list != NULL) {
+    slab_t* next = list->next;
+    mm_pages_free(list, cache->slab_size);
+    list = next;
+  }
+}
+
+static void drop_magazine(void* magazine);
+
+mm_slab_cache_t* mm_slab_create(size_t size, size_t align) {
+  if (align == 0)
+    align = SLAB_DEFAULT_ALIGN;
+  if ((align & (align - 1)) != 0 || align > SLAB_MAX_ALIGN || size == 0 || size > SIZE_MAX / 4)
+    return NULL;
+
+  size_t stride = align_up(size, align);
+  size_t slab_size = SLAB_MIN_SIZE;
+  while (slab_size < objects_offset(SLAB_MIN_OBJECTS, align) + SLAB_MIN_OBJECTS * stride)
+    slab_size *= 2;
+
+  size_t objects = slab_size / stride;
+  while (objects_offset(objects, align) + objects * stride > slab_size)
+    objects--;
+
+  mm_slab_cache_t* cache = mm_malloc(sizeof(mm_slab_cache_t));
+  if (cache == NULL)
+    return NULL;
+  memset(cache, 0, sizeof(*cache));
+  pthread_mutex_init(&cache->lock, NULL);
+  cache->has_key = pthread_key_create(&cache->magazine_key, drop_magazine) == 0;
+  cache->stride = stride;
+  cache->slab_size = slab_size;
+  cache->objects_offset = objects_offset(objects, align);
+  cache->objects_per_slab = objects;
+  cache->map_words = map_words(objects);
+  return cache;
+}
+
+static slab_t* new_slab(mm_slab_cache_t* cache) {
+  slab_t* slab = mm_pages_alloc(cache->slab_size, cache->slab_size);
+  if (slab == NULL)
+    return NULL;
+  slab->free_count = cache->objects_per_slab;
+  slab->hint = 0;
+  memset(slab->free_map, 0xff, cache->map_words * sizeof(uint64_t));
+  size_t tail = cache->objects_per_slab % 64;
+  if (tail != 0)
+    slab->free_map[cache->map_words - 1] = (1ULL << tail) - 1;
+  return slab;
+}
+
+/* Takes a free object from the slabs of CACHE, whose lock is held. */
+static void* take_object(mm_slab_cache_t* cache) {
+  slab_t* slab = cache->partial;
+  if (slab == NULL) {
+    slab = cache->empty;
+    if (slab != NULL) {
+      list_remove(&cache->empty, slab);
+      cache->empty_count--;
+    } else if ((slab = new_slab(cache)) == NULL) {
+      return NULL;
+    }
+    list_push(&cache->partial, slab);
+  }
+
+  size_t word = slab->hint;
+  while (slab->free_map[word] == 0)
+    word++;
+  int bit = __builtin_ctzll(slab->free_map[word]);
+  slab->free_map[word] &= ~(1ULL << bit);
+  slab->hint = word;
+  if (--slab->free_count == 0) {
+    list_remove(&cache->partial, slab);
+    list_push(&cache->full, slab);
+  }
+  return (char*)slab + cache->objects_offset + (word * 64 + bit) * cache->stride;
+}
+
+/* Returns OBJECT to its slab in CACHE, whose lock is held. */
+static void put_object(mm_slab_cache_t* cache, void* object) {
+  slab_t* slab = (slab_t*)((uintptr_t)object & ~(cache->slab_size - 1));
+  size_t index = ((char*)object - (char*)slab - cache->objects_offset) / cache->stride;
+  size_t word = index / 64;
+
+  if (slab->free_count == 0) {
+    list_remove(&cache->full, slab);
+    list_push(&cache->partial, slab);
+  }
+  slab->free_map[word] |= 1ULL << (index % 64);
+  if (word < slab->hint)
+    slab->hint = word;
+
+  if (++slab->free_count == cache->objects_per_slab) {
+    list_remove(&cache->partial, slab);
+    if (cache->empty_count < SLAB_MAX_EMPTY) {
+      list_push(&cache->empty, slab);
+      cache->empty_count++;
+    } else {
+      mm_pages_free(slab, cache->slab_size);
+    }
+  }
+}
+
+/* Returns the calling thread's magazine for CACHE, or NULL if it has none and cannot get one. */
+static magazine_t* get_magazine(mm_slab_cache_t* cache) {
+  if (!cache->has_key)
+    return NULL;
+  magazine_t* magazine = pthread_getspecific(cache->magazine_key);
+  if (magazine != NULL)
+    return magazine;
+
+  magazine = mm_malloc(sizeof(magazine_t));
+  if (magazine == NULL)
+    return NULL;
+  magazine->cache = cache;
+  magazine->count = 0;
+  magazine->prev = NULL;
+  pthread_mutex_lock(&cache->lock);
+  magazine->next = cache->magazines;
+  if (magazine->next != NULL)
+    magazine->next->prev = magazine;
+  cache->magazines = magazine;
+  pthread_mutex_unlock(&cache->lock);
+  pthread_setspecific(cache->magazine_key, magazine);
+  return magazine;
+}
+
+/* Thread exit: returns the thread's objects to the slabs and frees its magazine. */
+static void drop_magazine(void* arg) {
+  magazine_t* magazine = arg;
+  mm_slab_cache_t* cache = magazine->cache;
+  pthread_mutex_lock(&cache->lock);
+  while (magazine->count > 0)
+    put_object(cache, magazine->objects[--magazine->count]);
+  if (magazine->prev != NULL)
+    magazine->prev->next = magazine->next;
+  else
+    cache->magazines = magazine->next;
+  if (magazine->next != NULL)
+    magazine->next->prev = magazine->prev;
+  pthread_mutex_unlock(&cache->lock);
+  mm_free(magazine);
+}
+
+void* mm_slab_alloc(mm_slab_cache_t* cache) {
+  magazine_t* magazine = get_magazine(cache);
+  if (magazine != NULL && magazine->count > 0)
+    return magazine->objects[--magazine->count];
+
+  pthread_mutex_lock(&cache->lock);
+  void* object = take_object(cache);
+  /* Refill half the magazine, leaving room for frees before the next trip. */
+  while (magazine != NULL && object != NULL && magazine->count < SLAB_MAGAZINE_SIZE / 2) {
+    void* extra = take_object(cache);
+    if (extra == NULL)
+      break;
+    magazine->objects[magazine->count++] = extra;
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return object;
+}
+
+void mm_slab_free(mm_slab_cache_t* cache, void* object) {
+  if (object == NULL)
+    return;
+  magazine_t* magazine = get_magazine(cache);
+  if (magazine != NULL && magazine->count < SLAB_MAGAZINE_SIZE) {
+    magazine->objects[magazine->count++] = object;
+    return;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  put_object(cache, object);
+  /* Keep half the magazine for the allocations that usually follow. */
+  while (magazine != NULL && magazine->count > SLAB_MAGAZINE_SIZE / 2)
+    put_object(cache, magazine->objects[--magazine->count]);
+  pthread_mutex_unlock(&cache->lock);
+}
+
+void mm_slab_destroy(mm_slab_cache_t* cache) {
+  if (cache == NULL)
+    return;
+  /* Objects in magazines live in the slabs, which are freed below. */
+  if (cache->has_key)
+    pthread_key_delete(cache->magazine_key);
+  while (cache->magazines != NULL) {
+    magazine_t* next = cache->magazines->next;
+    mm_free(cache->magazines);
+    cache->magazines = next;
+  }
+  list_free(cache, cache->partial);
+  list_free(cache, cache->full);
+  list_free(cache, cache->empty);
+  pthread_mutex_destroy(&cache->lock);
+  mm_free(cache);
+}
@@ -0,0 +1,41 @@
+/*
+ * mm_slab.h
+ *
+ * Object caches for fixed-size objects, in the style of kmem_cache.
+ *
+ * A cache hands out objects of one size and alignment from slabs: aligned
+ * runs of pages that hold a small header, a bitmap of free objects, and the
+ * objects themselves. Objects carry no per-object header, and allocating
+ * or freeing one is usually a push or pop on a per-thread magazine, and
+ * otherwise a bit operation on its slab.
+ */
+
+#pragma once
+
+#ifndef _mm_slab_H_
+#define _mm_slab_H_
+
+#include <stdlib.h>
+
+typedef struct mm_slab_cache mm_slab_cache_t;
+
+/*
+ * Creates a cache of objects of SIZE bytes aligned to ALIGN, a power of two
+ * no larger than 4096 (0 means 16). Returns NULL on bad arguments or when
+ * out of memory.
+ */
+mm_slab_cache_t* mm_slab_create(size_t size, size_t align);
+
+/* Returns a new object from CACHE, or NULL when out of memory. */
+void* mm_slab_alloc(mm_slab_cache_t* cache);
+
+/* Returns OBJECT, which came from mm_slab_alloc(CACHE), to CACHE. */
+void mm_slab_free(mm_slab_cache_t* cache, void* object);
+
+/*
+ * Frees CACHE and every object still allocated from it. No other thread may
+ * be using CACHE.
+ */
+void mm_slab_destroy(mm_slab_cache_t* cache);
+
+#endif
@@ -0,0 +1,182 @@
+/*
+ * mm_stress.c
+ *
+ * Multi-threaded stress test and benchmark for hw3lib.so.
+ *
+ * Each thread runs a random mix of mallocs and frees over its own slots.
+ * Some blocks are handed to other threads through a shared mailbox and
+ * freed there, which exercises cross-thread frees. Every block is filled
+ * with a pattern derived from its size and checked before it is freed.
+ * The same workload is then run against the C library malloc.
+ *
+ * Usage: mm_stress [THREADS] [OPS_PER_THREAD]
+ */
+
+#include <assert.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SLOTS 512
+#define MAILBOX_SIZE 256
+
+typedef struct allocator {
+  const char* name;
+  void* (*malloc)(size_t);
+  void (*free)(void*);
+} allocator_t;
+
+typedef struct worker {
+  pthread_t thread;
+  allocator_t* allocator;
+  long ops;
+  unsigned long seed;
+} worker_t;
+
+static void* mailbox[MAILBOX_SIZE];
+
+static void* try_dlsym(void* handle, const char* symbol) {
+  char* error;
+  void* function = dlsym(handle, symbol);
+  if ((error = dlerror())) {
+    fprintf(stderr, "%s\n", error);
+    exit(EXIT_FAILURE);
+  }
+  return function;
+}
+
+static void load_alloc_functions(allocator_t* allocator) {
+  void* handle = dlopen("hw3lib.so", RTLD_NOW);
+  if (!handle) {
+    fprintf(stderr, "%s\n", dlerror());
+    exit(EXIT_FAILURE);
+  }
+
+  allocator->name = "mm_malloc";
+  allocator->malloc = try_dlsym(handle, "mm_malloc");
+  allocator->free = try_dlsym(handle, "mm_free");
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long next_random(unsigned long* state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+/* Mostly small blocks, with the occasional larger one. */
+static size_t random_size(unsigned long* state) {
+  unsigned long r = next_random(state);
+  if (r % 16 == 0)
+    return r / 16 % 8192 + 1;
+  return r / 16 % 512 + 1;
+}
+
+/* Blocks store their size in the first word and a size-derived byte after it. */
+static void* fill_block(allocator_t* allocator, size_t size) {
+  if (size < sizeof(size_t))
+    size = sizeof(size_t);
+  unsigned char* block = allocator->malloc(size);
+  assert(block != NULL);
+  assert((uintptr_t)block % 16 == 0);
+  *(size_t*)block = size;
+  memset(block + sizeof(size_t), (unsigned char)size, size - sizeof(size_t));
+  return block;
+}
+
+static void check_and_free(allocator_t* allocator, unsigned char* block) {
+  size_t size = *(size_t*)block;
+  unsigned char pattern = (unsigned char)size;
+  if (size > sizeof(size_t)) {
+    assert(block[sizeof(size_t)] == pattern);
+    assert(block[size / 2 + sizeof(size_t) / 2] == pattern);
+    assert(block[size - 1] == pattern);
+  }
+  allocator->free(block);
+}
+
+static void* run_worker(void* arg) {
+  worker_t* worker = arg;
+  allocator_t* allocator = worker->allocator;
+  unsigned long state = worker->seed;
+  void* slots[SLOTS] = {NULL};
+
+  for (long i = 0; i < worker->ops; i++) {
+    unsigned long r = next_random(&state);
+    int slot = r % SLOTS;
+    if (slots[slot] == NULL) {
+      slots[slot] = fill_block(allocator, random_size(&state));
+    } else if (r / SLOTS % 8 == 0) {
+      /* Trade the block for whatever another thread left in the mailbox. */
+      void* other = __atomic_exchange_n(&mailbox[r / SLOTS / 8 % MAILBOX_SIZE], slots[slot],
+                                        __ATOMIC_ACQ_REL);
+      if (other != NULL)
+        check_and_free(allocator, other);
+      slots[slot] = NULL;
+    } else {
+      check_and_free(allocator, slots[slot]);
+      slots[slot] = NULL;
+    }
+  }
+
+  for (int slot = 0; slot < SLOTS; slot++) {
+    if (slots[slot] != NULL)
+      check_and_free(allocator, slots[slot]);
+  }
+  return NULL;
+}
+
+/* Runs the workload on THREADS threads and returns operations per second. */
+static double run(allocator_t* allocator, int threads, long ops) {
+  worker_t* workers = calloc(threads, sizeof(worker_t));
+  assert(workers != NULL);
+
+  double start = now();
+  for (int i = 0; i < threads; i++) {
+    workers[i].allocator = allocator;
+    workers[i].ops = ops;
+    workers[i].seed = 0x162 + i * 7919;
+    pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]);
+  }
+  for (int i = 0; i < threads; i++)
+    pthread_join(workers[i].thread, NULL);
+  double elapsed = now() - start;
+
+  for (int i = 0; i < MAILBOX_SIZE; i++) {
+    if (mailbox[i] != NULL)
+      check_and_free(allocator, mailbox[i]);
+    mailbox[i] = NULL;
+  }
+  free(workers);
+  return threads * ops / elapsed;
+}
+
+int main(int argc, char** argv) {
+  int threads = argc > 1 ? atoi(argv[1]) : 4;
+  long ops = argc > 2 ? atol(argv[2]) : 1000000;
+  if (threads <= 0 || ops <= 0) {
+    fprintf(stderr, "Usage: %s [THREADS] [OPS_PER_THREAD]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  allocator_t mm;
+  load_alloc_functions(&mm);
+  allocator_t libc = {"libc malloc", malloc, free};
+
+  allocator_t* allocators[] = {&mm, &libc};
+  for (size_t i = 0; i < sizeof(allocators) / sizeof(allocators[0]); i++) {
+    double rate = run(allocators[i], threads, ops);
+    printf("%-12s %2d threads: %6.2f Mops/s\n", allocators[i]->name, threads, rate / 1e6);
+  }
+  puts("malloc stress test successful!");
+}
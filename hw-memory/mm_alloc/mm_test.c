@@ -1,12 +1,31 @@
 #include <assert.h>
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mm_types.h"
 
 /* Function pointers to hw3 functions */
 void* (*mm_malloc)(size_t);
 void* (*mm_realloc)(void*, size_t);
 void (*mm_free)(void*);
+void* (*mm_memalign)(size_t, size_t);
+int (*mm_posix_memalign)(void**, size_t, size_t);
+int (*mm_mallopt)(int, int);
+void* (*mm_slab_create)(size_t, size_t);
+void* (*mm_slab_alloc)(void*);
+void (*mm_slab_free)(void*, void*);
+void (*mm_slab_destroy)(void*);
+void (*mm_stats)(mm_stats_t*);
+void (*mm_profile_start)(unsigned int);
+void (*mm_profile_stop)(void);
+void (*mm_profile_report)(int);
 
 static void* try_dlsym(void* handle, const char* symbol) {
   char* error;
@@ -28,14 +47,531 @@ static void load_alloc_functions() {
   mm_malloc = try_dlsym(handle, "mm_malloc");
   mm_realloc = try_dlsym(handle, "mm_realloc");
   mm_free = try_dlsym(handle, "mm_free");
+  mm_memalign = try_dlsym(handle, "mm_memalign");
+  mm_posix_memalign = try_dlsym(handle, "mm_posix_memalign");
+  mm_mallopt = try_dlsym(handle, "mm_mallopt");
+  mm_slab_create = try_dlsym(handle, "mm_slab_create");
+  mm_slab_alloc = try_dlsym(handle, "mm_slab_alloc");
+  mm_slab_free = try_dlsym(handle, "mm_slab_free");
+  mm_slab_destroy = try_dlsym(handle, "mm_slab_destroy");
+  mm_stats = try_dlsym(handle, "mm_stats");
+  mm_profile_start = try_dlsym(handle, "mm_profile_start");
+  mm_profile_stop = try_dlsym(handle, "mm_profile_stop");
+  mm_profile_report = try_dlsym(handle, "mm_profile_report");
 }
 
-int main() {
-  load_alloc_functions();
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
+/* Resident set size, read without going through malloc. */
+static long resident_bytes() {
+  char buffer[128] = {0};
+  long size, resident;
+  int fd = open("/proc/self/statm", O_RDONLY);
+  assert(fd >= 0);
+  assert(read(fd, buffer, sizeof(buffer) - 1) > 0);
+  close(fd);
+  assert(sscanf(buffer, "%ld %ld", &size, &resident) == 2);
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void test_basic() {
   int* data = mm_malloc(sizeof(int));
   assert(data != NULL);
   data[0] = 0x162;
   mm_free(data);
+
+  assert(mm_malloc(0) == NULL);
+  mm_free(NULL);
+}
+
+/* Random mallocs, reallocs and frees, checking that no block is corrupted. */
+static void test_random() {
+  enum { SLOTS = 2048, ROUNDS = 200000 };
+  static unsigned char* ptrs[SLOTS];
+  static size_t sizes[SLOTS];
+
+  srand(162);
+  for (int i = 0; i < ROUNDS; i++) {
+    int slot = rand() % SLOTS;
+    if (ptrs[slot] != NULL) {
+      for (size_t j = 0; j < sizes[slot]; j++)
+        assert(ptrs[slot][j] == (unsigned char)(slot + j));
+    }
+
+    size_t size = rand() % 4 == 0 ? rand() % 20000 + 1 : rand() % 300 + 1;
+    if (ptrs[slot] != NULL && rand() % 2 == 0) {
+      ptrs[slot] = mm_realloc(ptrs[slot], size);
+      assert(ptrs[slot] != NULL);
+      size_t kept = size < sizes[slot] ? size : sizes[slot];
+      for (size_t j = 0; j < kept; j++)
+        assert(ptrs[slot][j] == (unsigned char)(slot + j));
+    } else {
+      mm_free(ptrs[slot]);
+      ptrs[slot] = mm_malloc(size);
+      assert(ptrs[slot] != NULL);
+    }
+    assert((uintptr_t)ptrs[slot] % 16 == 0);
+    sizes[slot] = size;
+    for (size_t j = 0; j < size; j++)
+      ptrs[slot][j] = (unsigned char)(slot + j);
+  }
+
+  for (int i = 0; i < SLOTS; i++) {
+    mm_free(ptrs[i]);
+    ptrs[i] = NULL;
+  }
+}
+
+/* Large blocks are mapped on their own and grow with mremap instead of copies. */
+static void test_mmap() {
+  enum { STEP = 1 << 20, MAX_SIZE = 256 << 20 };
+  char* brk = sbrk(0);
+  char* data = mm_malloc(STEP);
+  assert(data != NULL);
+  assert((uintptr_t)data % 16 == 0);
+  assert(sbrk(0) == brk);
+  data[0] = 0x62;
+  data[STEP - 1] = 0x62;
+
+  double start = now();
+  for (size_t size = STEP; size < MAX_SIZE; size += STEP) {
+    data = mm_realloc(data, size + STEP);
+    assert(data != NULL);
+    assert(data[0] == 0x62 && data[size - 1] == 0x62);
+    data[size + STEP - 1] = 0x62;
+  }
+  double elapsed = (now() - start) / (MAX_SIZE / STEP - 1);
+  printf("realloc of a large block: %.1f us per 1 MiB step up to 256 MiB\n", elapsed * 1e6);
+  assert(sbrk(0) == brk);
+
+  data = mm_realloc(data, STEP);
+  assert(data != NULL && data[0] == 0x62 && data[STEP - 1] == 0x62);
+  mm_free(data);
+
+  assert(mm_mallopt(MM_MMAP_THRESHOLD, -1) == 0);
+  assert(mm_mallopt(MM_MMAP_THRESHOLD, 4096) == 1);
+  brk = sbrk(0);
+  data = mm_malloc(8192);
+  assert(data != NULL && sbrk(0) == brk);
+  mm_free(data);
+}
+
+/* Freed memory goes back to the OS, from the top of the heap and from inside it. */
+static void test_release() {
+  enum { BLOCKS = 4096, SIZE = 1000 };
+  static char* blocks[BLOCKS];
+
+  for (int i = 0; i < BLOCKS; i++) {
+    blocks[i] = mm_malloc(SIZE);
+    memset(blocks[i], i, SIZE);
+  }
+  char* top = sbrk(0);
+  for (int i = 0; i < BLOCKS; i++)
+    mm_free(blocks[i]);
+  assert((char*)sbrk(0) < top - BLOCKS * SIZE / 2);
+
+  /* With an allocated block at the top, the heap cannot shrink, so the
+   * pages are released where they are. */
+  for (int i = 0; i < BLOCKS; i++) {
+    blocks[i] = mm_malloc(SIZE);
+    memset(blocks[i], i, SIZE);
+  }
+  char* pin = mm_malloc(SIZE);
+  long resident = resident_bytes();
+  for (int i = 0; i < BLOCKS; i++)
+    mm_free(blocks[i]);
+  assert(resident_bytes() < resident - BLOCKS * SIZE / 2);
+  mm_free(pin);
+
+  /* Space split off a block counts as dirty, whatever bytes it held: freeing
+   * a small block next to it still releases it. */
+  enum { LARGE = 4 << 20 };
+  assert(mm_mallopt(MM_MMAP_THRESHOLD, 2 * LARGE) == 1);
+  char* large = mm_malloc(LARGE);
+  pin = mm_malloc(SIZE);
+  memset(large, 0, LARGE);
+  large = mm_realloc(large, SIZE);
+  resident = resident_bytes();
+  mm_free(large);
+  assert(resident_bytes() < resident - LARGE / 2);
+  mm_free(pin);
+  assert(mm_mallopt(MM_MMAP_THRESHOLD, 128 * 1024) == 1);
+}
+
+static void test_slab() {
+  enum { OBJECTS = 100000 };
+  static size_t* objects[OBJECTS];
+
+  assert(mm_slab_create(0, 16) == NULL);
+  assert(mm_slab_create(40, 24) == NULL);
+
+  void* cache = mm_slab_create(40, 64);
+  assert(cache != NULL);
+  for (int round = 0; round < 2; round++) {
+    for (int i = round; i < OBJECTS; i += 1 + round) {
+      objects[i] = mm_slab_alloc(cache);
+      assert(objects[i] != NULL);
+      assert((uintptr_t)objects[i] % 64 == 0);
+      for (int j = 0; j < 5; j++)
+        objects[i][j] = i;
+    }
+    for (int i = 0; i < OBJECTS; i++) {
+      for (int j = 0; j < 5; j++)
+        assert(objects[i][j] == (size_t)i);
+    }
+    /* Free every other object, then refill the holes in the next round. */
+    for (int i = 1; i < OBJECTS; i += 2)
+      mm_slab_free(cache, objects[i]);
+  }
+  for (int i = 0; i < OBJECTS; i += 2)
+    mm_slab_free(cache, objects[i]);
+  mm_slab_destroy(cache);
+
+  /* Objects larger than a default slab still fit several to a slab. */
+  cache = mm_slab_create(100000, 0);
+  assert(cache != NULL);
+  for (int i = 0; i < 20; i++) {
+    objects[i] = mm_slab_alloc(cache);
+    assert(objects[i] != NULL && (uintptr_t)objects[i] % 16 == 0);
+    memset(objects[i], i, 100000);
+  }
+  for (int i = 0; i < 20; i++)
+    assert(((unsigned char*)objects[i])[99999] == i);
+  mm_slab_destroy(cache);
+}
+
+enum { SLAB_THREADS = 4, SLAB_PER_THREAD = 10000 };
+static void* slab_cache;
+static size_t* slab_objects[SLAB_THREADS][SLAB_PER_THREAD];
+
+/* Frees the previous thread's objects, then allocates its own and exits with them in use. */
+static void* slab_worker(void* arg) {
+  int id = (int)(intptr_t)arg;
+  for (int i = 0; id > 0 && i < SLAB_PER_THREAD; i++) {
+    assert(*slab_objects[id - 1][i] == (size_t)(id - 1) * SLAB_PER_THREAD + i);
+    mm_slab_free(slab_cache, slab_objects[id - 1][i]);
+  }
+  for (int i = 0; i < SLAB_PER_THREAD; i++) {
+    slab_objects[id][i] = mm_slab_alloc(slab_cache);
+    assert(slab_objects[id][i] != NULL);
+    *slab_objects[id][i] = (size_t)id * SLAB_PER_THREAD + i;
+  }
+  return NULL;
+}
+
+/* Objects freed on other threads, or left in exited threads' magazines, are reused. */
+static void test_slab_threads() {
+  slab_cache = mm_slab_create(sizeof(size_t), 0);
+  assert(slab_cache != NULL);
+  for (int round = 0; round < 3; round++) {
+    for (int id = 0; id < SLAB_THREADS; id++) {
+      pthread_t thread;
+      assert(pthread_create(&thread, NULL, slab_worker, (void*)(intptr_t)id) == 0);
+      pthread_join(thread, NULL);
+    }
+    for (int i = 0; i < SLAB_PER_THREAD; i++)
+      mm_slab_free(slab_cache, slab_objects[SLAB_THREADS - 1][i]);
+  }
+  mm_slab_destroy(slab_cache);
+}
+
+/* Average time of replacing a random one of LIVE objects of SIZE bytes. */
+static double time_churn(void* cache, size_t size) {
+  enum { LIVE = 50000, ROUNDS = 2000000 };
+  static void* live[LIVE];
+
+  for (int i = 0; i < LIVE; i++)
+    live[i] = cache != NULL ? mm_slab_alloc(cache) : mm_malloc(size);
+  srand(162);
+  double start = now();
+  for (int i = 0; i < ROUNDS; i++) {
+    int slot = rand() % LIVE;
+    if (cache != NULL) {
+      mm_slab_free(cache, live[slot]);
+      live[slot] = mm_slab_alloc(cache);
+    } else {
+      mm_free(live[slot]);
+      live[slot] = mm_malloc(size);
+    }
+    *(int*)live[slot] = i;
+  }
+  double elapsed = (now() - start) / ROUNDS;
+  for (int i = 0; i < LIVE; i++) {
+    if (cache != NULL)
+      mm_slab_free(cache, live[i]);
+    else
+      mm_free(live[i]);
+  }
+  return elapsed;
+}
+
+static void bench_slab() {
+  size_t sizes[] = {24, 48, 200, 2000};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    void* cache = mm_slab_create(sizes[i], 0);
+    double slab = time_churn(cache, sizes[i]);
+    double malloc = time_churn(NULL, sizes[i]);
+    mm_slab_destroy(cache);
+    printf("churn of %zu-byte objects: %.1f ns with mm_slab, %.1f ns with mm_malloc\n", sizes[i],
+           slab * 1e9, malloc * 1e9);
+  }
+}
+
+static size_t heap_blocks(mm_stats_t* stats) {
+  size_t blocks = 0;
+  for (int i = 0; i < MM_STATS_CLASSES; i++)
+    blocks += stats->class_blocks[i];
+  return blocks;
+}
+
+static void test_stats() {
+  mm_stats_t before, during, after;
+  mm_stats(&before);
+
+  void* small[100];
+  for (int i = 0; i < 100; i++)
+    small[i] = mm_malloc(1000);
+  void* large = mm_malloc(1 << 20);
+  mm_stats(&during);
+  assert(during.in_use >= before.in_use + 100 * 1000 + (1 << 20));
+  assert(during.peak_in_use >= during.in_use);
+  assert(during.mapped >= during.in_use);
+  assert(during.mmapped_blocks == before.mmapped_blocks + 1);
+  assert(heap_blocks(&during) == heap_blocks(&before) + 100);
+  assert(during.largest_free <= during.free);
+  assert(during.fragmentation >= 0 && during.fragmentation <= 1);
+
+  for (int i = 0; i < 100; i++)
+    mm_free(small[i]);
+  mm_free(large);
+  mm_stats(&after);
+  assert(after.in_use == before.in_use);
+  assert(after.peak_in_use == during.peak_in_use);
+  assert(heap_blocks(&after) == heap_blocks(&before));
+}
+
+/*
+ * Aligned blocks come from the heap, and the space in front of them is
+ * reused. They are too big for the thread cache, so freeing them shows in
+ * the stats.
+ */
+static void test_memalign() {
+  enum { BLOCKS = 256 };
+  static char* blocks[BLOCKS];
+  mm_stats_t before, during, after;
+  mm_stats(&before);
+
+  for (int i = 0; i < BLOCKS; i++) {
+    size_t alignment = (size_t)32 << (i % 8);
+    size_t size = 600 + i * 37 % 3000;
+    blocks[i] = mm_memalign(alignment, size);
+    assert(blocks[i] != NULL);
+    assert((uintptr_t)blocks[i] % alignment == 0);
+    memset(blocks[i], i, size);
+  }
+  mm_stats(&during);
+  assert(during.mmapped_blocks == before.mmapped_blocks);
+  /* Only the blocks themselves are in use, not the padding in front of them. */
+  assert(during.in_use - before.in_use < BLOCKS * (3600 + 2 * 16));
+
+  for (int i = 0; i < BLOCKS; i++) {
+    size_t size = 600 + i * 37 % 3000;
+    assert(blocks[i][0] == (char)i && blocks[i][size - 1] == (char)i);
+    mm_free(blocks[i]);
+  }
+  mm_stats(&after);
+  assert(after.in_use == before.in_use);
+
+  void* ptr = NULL;
+  assert(mm_memalign(24, 100) == NULL);
+  assert(mm_posix_memalign(&ptr, 4, 100) != 0);
+  assert(mm_posix_memalign(&ptr, 4096, 100) == 0 && (uintptr_t)ptr % 4096 == 0);
+  mm_free(ptr);
+  ptr = mm_memalign(1 << 20, 1000);
+  assert(ptr != NULL && (uintptr_t)ptr % (1 << 20) == 0);
+  mm_free(ptr);
+}
+
+/* Bytes of the process backed by transparent huge pages, or -1 if unknown. */
+static long huge_page_bytes() {
+  FILE* smaps = fopen("/proc/self/smaps_rollup", "r");
+  if (smaps == NULL)
+    return -1;
+  char line[256];
+  long kb = -1;
+  while (fgets(line, sizeof(line), smaps) != NULL) {
+    if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1)
+      break;
+  }
+  fclose(smaps);
+  return kb < 0 ? -1 : kb * 1024;
+}
+
+/*
+ * Average time of a read at a random position in one of the COUNT blocks of
+ * SIZE bytes. Each position depends on the byte read before, so the reads
+ * cannot overlap and every TLB miss shows.
+ */
+static double time_random_reads(char** blocks, int count, size_t size) {
+  enum { READS = 2000000 };
+  unsigned long state = 0x162;
+  double start = now();
+  for (int i = 0; i < READS; i++) {
+    state = state * 6364136223846793005UL + 1442695040888963407UL;
+    state += blocks[(state >> 33) % count][(state >> 17) % size];
+  }
+  double elapsed = (now() - start) / READS;
+  assert(state != 1);
+  return elapsed;
+}
+
+/*
+ * With MM_HUGEPAGES, a large heap gets huge pages if the kernel hands them
+ * out, and random reads over it miss the TLB less.
+ */
+static void test_hugepages() {
+  enum { BLOCKS = 512, SIZE = 64 * 1024 };
+  static char* small_pages[BLOCKS];
+  static char* huge_pages[BLOCKS];
+
+  for (int i = 0; i < BLOCKS; i++) {
+    small_pages[i] = mm_malloc(SIZE);
+    assert(small_pages[i] != NULL);
+    memset(small_pages[i], i, SIZE);
+  }
+
+  long before = huge_page_bytes();
+  assert(mm_mallopt(MM_HUGEPAGES, 1) == 1);
+  for (int i = 0; i < BLOCKS; i++) {
+    huge_pages[i] = mm_malloc(SIZE);
+    assert(huge_pages[i] != NULL);
+    memset(huge_pages[i], i, SIZE);
+  }
+  long after = huge_page_bytes();
+
+  double small = time_random_reads(small_pages, BLOCKS, SIZE);
+  double huge = time_random_reads(huge_pages, BLOCKS, SIZE);
+  printf("random reads over 32 MiB: %.1f ns with small pages, %.1f ns with MM_HUGEPAGES "
+         "(%ld MiB in huge pages)\n",
+         small * 1e9, huge * 1e9, after < 0 ? -1 : (after - before) >> 20);
+
+  for (int i = 0; i < BLOCKS; i++) {
+    mm_free(small_pages[i]);
+    mm_free(huge_pages[i]);
+  }
+  assert(mm_mallopt(MM_HUGEPAGES, 0) == 1);
+}
+
+static void* __attribute__((noinline)) profiled_allocation(size_t size) { return mm_malloc(size); }
+
+static void* __attribute__((noinline)) profiled_reallocation(size_t size) {
+  return mm_realloc(NULL, size);
+}
+
+static void test_profile() {
+  FILE* report = tmpfile();
+  assert(report != NULL);
+
+  mm_profile_start(10);
+  void* blocks[1000];
+  for (int i = 0; i < 1000; i++)
+    blocks[i] = profiled_allocation(100);
+  mm_profile_stop();
+  for (int i = 0; i < 1000; i++)
+    mm_free(blocks[i]);
+  mm_profile_report(fileno(report));
+
+  char line[256];
+  rewind(report);
+  assert(fgets(line, sizeof(line), report) != NULL);
+  assert(strncmp(line, "mm_profile: 100 samples", 23) == 0);
+  int found = 0;
+  while (fgets(line, sizeof(line), report) != NULL) {
+    if (strstr(line, "100 samples, 10000 bytes sampled") != NULL)
+      found = 1;
+  }
+  assert(found);
+  fclose(report);
+
+  /* mm_realloc reaches the sampling point through mm_malloc, but the stack
+   * still starts in the caller, not in the library. */
+  report = tmpfile();
+  assert(report != NULL);
+  mm_profile_start(10);
+  for (int i = 0; i < 1000; i++)
+    blocks[i] = profiled_reallocation(100);
+  mm_profile_stop();
+  for (int i = 0; i < 1000; i++)
+    mm_free(blocks[i]);
+  mm_profile_report(fileno(report));
+
+  rewind(report);
+  found = 0;
+  while (fgets(line, sizeof(line), report) != NULL) {
+    if (strstr(line, "100 samples, 10000 bytes sampled") != NULL) {
+      assert(fgets(line, sizeof(line), report) != NULL);
+      assert(strstr(line, "hw3lib.so") == NULL);
+      found = 1;
+    }
+  }
+  assert(found);
+  fclose(report);
+}
+
+/*
+ * Leaves FRAGMENTS free blocks that cannot be coalesced in the heap, then
+ * returns the average time of a malloc/free pair that none of them fits.
+ */
+static double time_with_fragments(int fragments) {
+  enum { ROUNDS = 100000 };
+  void** small = malloc(2 * fragments * sizeof(void*));
+  for (int i = 0; i < 2 * fragments; i++)
+    small[i] = mm_malloc(64);
+  for (int i = 0; i < 2 * fragments; i += 2)
+    mm_free(small[i]);
+
+  double start = now();
+  for (int i = 0; i < ROUNDS; i++)
+    mm_free(mm_malloc(1000 + i % 64));
+  double elapsed = (now() - start) / ROUNDS;
+
+  for (int i = 1; i < 2 * fragments; i += 2)
+    mm_free(small[i]);
+  free(small);
+  return elapsed;
+}
+
+/* malloc must not get slower as the number of free blocks grows. */
+static void test_constant_time() {
+  double few = time_with_fragments(100);
+  double many = time_with_fragments(200000);
+  printf("malloc+free: %.1f ns with 100 free blocks, %.1f ns with 200000\n", few * 1e9,
+         many * 1e9);
+  assert(many < 5 * few + 100e-9);
+}
+
+int main() {
+  load_alloc_functions();
+
+  test_basic();
+  /* Runs before anything else grows the heap, so its blocks come from the top. */
+  test_release();
+  test_random();
+  test_mmap();
+  /* test_mmap() left the threshold low, so this run mixes in mapped blocks. */
+  test_random();
+  assert(mm_mallopt(MM_MMAP_THRESHOLD, 128 * 1024) == 1);
+  test_slab();
+  test_slab_threads();
+  bench_slab();
+  test_stats();
+  test_memalign();
+  test_hugepages();
+  test_profile();
+  test_constant_time();
   puts("malloc test successful!");
 }
@@ -0,0 +1,478 @@
+/*
+ * mm_trace.c
+ *
+ * Replays allocation traces against mm_malloc and the C library malloc and
+ * reports throughput, peak heap and memory utilization for each.
+ *
+ * A trace is a text file with one request per line:
+ *
+ *   a ID SIZE         malloc(SIZE) returned the block ID
+ *   r ID NEW_ID SIZE  realloc(ID, SIZE) returned NEW_ID
+ *   f ID              free(ID)
+ *
+ * IDs are the addresses the recorded program saw, in hex. Lines starting
+ * with '#' are comments. Traces are recorded by running a program on
+ * libmm.so with MM_TRACE set (see mm_preload.c). Recording starts after the
+ * program's first few allocations, so requests on unknown IDs are skipped,
+ * and a realloc of an unknown ID is replayed as a malloc. The recorded
+ * program may have been multi-threaded; the replay is not.
+ *
+ * The harness keeps its own data out of the C library heap, and each trace
+ * is replayed in a fresh process per allocator, first once with every block
+ * written and checked and the heap measured after each allocation, then
+ * REPEAT times for timing. Peak heap is the largest growth of anonymous
+ * resident memory during the replay, which counts the memory an allocator
+ * touched rather than what it reserved. Utilization is the peak number of bytes requested
+ * and not yet freed, divided by the peak heap.
+ *
+ * mm_malloc is loaded from LIBRARY, hw3lib.so by default. Use libmm.so to
+ * compare the optimized build with the C library.
+ *
+ * Usage: mm_trace [-l LIBRARY] [-r REPEAT] TRACE...
+ */
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct request {
+  char type; // 'a', 'r' or 'f'.
+  size_t slot;
+  size_t size;
+} request_t;
+
+/* A trace with its IDs renumbered to slots 0, 1, 2... */
+typedef struct trace {
+  const char* name;
+  request_t* requests;
+  size_t capacity;
+  size_t count;
+  size_t slots;
+} trace_t;
+
+typedef struct allocator {
+  const char* name;
+  void* (*malloc)(size_t);
+  void* (*realloc)(void*, size_t);
+  void (*free)(void*);
+} allocator_t;
+
+typedef struct result {
+  double ops_per_second;
+  size_t peak_live;
+  size_t peak_heap;
+} result_t;
+
+/* Maps recorded IDs to slots with open addressing. */
+typedef struct id_entry {
+  uint64_t id;
+  size_t slot;
+  int live;
+} id_entry_t;
+
+typedef struct id_map {
+  id_entry_t* entries;
+  size_t capacity;
+} id_map_t;
+
+static void* try_dlsym(void* handle, const char* symbol) {
+  char* error;
+  void* function = dlsym(handle, symbol);
+  if ((error = dlerror())) {
+    fprintf(stderr, "%s\n", error);
+    exit(EXIT_FAILURE);
+  }
+  return function;
+}
+
+static void load_mm_functions(allocator_t* allocator, const char* library) {
+  void* handle = dlopen(library, RTLD_NOW);
+  if (!handle) {
+    fprintf(stderr, "%s\n", dlerror());
+    exit(EXIT_FAILURE);
+  }
+
+  allocator->malloc = try_dlsym(handle, "mm_malloc");
+  allocator->realloc = try_dlsym(handle, "mm_realloc");
+  allocator->free = try_dlsym(handle, "mm_free");
+}
+
+/* Reads the anonymous part of the resident set, leaving out code, without allocating. */
+static size_t resident_bytes() {
+  char buffer[128] = {0};
+  long size, resident, shared;
+  int fd = open("/proc/self/statm", O_RDONLY);
+  if (fd < 0 || read(fd, buffer, sizeof(buffer) - 1) <= 0 ||
+      sscanf(buffer, "%ld %ld %ld", &size, &resident, &shared) != 3) {
+    perror("/proc/self/statm");
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+  return (resident - shared) * sysconf(_SC_PAGESIZE);
+}
+
+/* Returns SIZE bytes of zeroed memory straight from the kernel. */
+static void* map_memory(size_t size) {
+  void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    perror("mmap");
+    exit(EXIT_FAILURE);
+  }
+  return memory;
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t hash_id(uint64_t id) {
+  id ^= id >> 33;
+  id *= 0xff51afd7ed558ccdULL;
+  return id ^ (id >> 33);
+}
+
+static id_entry_t* find_id(id_map_t* map, uint64_t id) {
+  size_t mask = map->capacity - 1;
+  for (size_t i = hash_id(id) & mask;; i = (i + 1) & mask) {
+    if (!map->entries[i].live && map->entries[i].id == 0)
+      return &map->entries[i];
+    if (map->entries[i].id == id)
+      return &map->entries[i];
+  }
+}
+
+/* Returns the live slot of ID, or NULL if it is not allocated. */
+static id_entry_t* live_id(id_map_t* map, uint64_t id) {
+  id_entry_t* entry = find_id(map, id);
+  return entry->live ? entry : NULL;
+}
+
+static void set_id(id_map_t* map, uint64_t id, size_t slot) {
+  id_entry_t* entry = find_id(map, id);
+  entry->id = id;
+  entry->slot = slot;
+  entry->live = 1;
+}
+
+static void add_request(trace_t* trace, char type, size_t slot, size_t size) {
+  trace->requests[trace->count++] = (request_t){type, slot, size};
+}
+
+/* Reads the whole file at PATH, NUL-terminated, into fresh memory of *SIZE bytes. */
+static char* read_file(const char* path, size_t* size) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror(path);
+    if (fd >= 0)
+      close(fd);
+    return NULL;
+  }
+
+  *size = st.st_size + 1;
+  char* text = map_memory(*size);
+  for (size_t done = 0; done < (size_t)st.st_size;) {
+    ssize_t n = read(fd, text + done, st.st_size - done);
+    if (n <= 0) {
+      perror(path);
+      munmap(text, *size);
+      close(fd);
+      return NULL;
+    }
+    done += n;
+  }
+  close(fd);
+  return text;
+}
+
+static int load_trace(const char* path, trace_t* trace) {
+  size_t text_size;
+  char* text = read_file(path, &text_size);
+  if (text == NULL)
+    return -1;
+
+  /* There is at most one request per line and one ID per request. */
+  size_t lines = 1;
+  for (char* c = text; (c = strchr(c, '\n')) != NULL; c++)
+    lines++;
+  id_map_t ids = {NULL, 1};
+  while (ids.capacity < 2 * lines)
+    ids.capacity *= 2;
+  ids.entries = map_memory(ids.capacity * sizeof(id_entry_t));
+
+  memset(trace, 0, sizeof(*trace));
+  trace->name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+  trace->capacity = lines;
+  trace->requests = map_memory(lines * sizeof(request_t));
+
+  int status = 0;
+  size_t line_number = 0;
+  for (char *line = text, *end; *line != '\0'; line = end + 1) {
+    line_number++;
+    end = strchr(line, '\n');
+    if (end == NULL)
+      end = line + strlen(line) - 1;
+    else
+      *end = '\0';
+
+    unsigned long id, new_id;
+    size_t size;
+    id_entry_t* entry;
+    if (line[0] == '#' || line[0] == '\0') {
+      continue;
+    } else if (sscanf(line, "a %lx %zu", &id, &size) == 2) {
+      set_id(&ids, id, trace->slots);
+      add_request(trace, 'a', trace->slots++, size);
+    } else if (sscanf(line, "r %lx %lx %zu", &id, &new_id, &size) == 3) {
+      if ((entry = live_id(&ids, id)) == NULL) {
+        set_id(&ids, new_id, trace->slots);
+        add_request(trace, 'a', trace->slots++, size);
+      } else {
+        size_t slot = entry->slot;
+        entry->live = 0;
+        set_id(&ids, new_id, slot);
+        add_request(trace, 'r', slot, size);
+      }
+    } else if (sscanf(line, "f %lx", &id) == 1) {
+      if ((entry = live_id(&ids, id)) != NULL) {
+        entry->live = 0;
+        add_request(trace, 'f', entry->slot, 0);
+      }
+    } else {
+      fprintf(stderr, "%s:%zu: bad request: %s\n", path, line_number, line);
+      status = -1;
+      break;
+    }
+  }
+
+  munmap(ids.entries, ids.capacity * sizeof(id_entry_t));
+  munmap(text, text_size);
+  if (status < 0)
+    munmap(trace->requests, trace->capacity * sizeof(request_t));
+  return status;
+}
+
+/*
+ * Fills each block, as the recorded program would have, and tags its ends
+ * with its slot, so overlapping blocks are caught.
+ */
+static void tag_block(unsigned char* block, size_t slot, size_t size) {
+  memset(block, (unsigned char)slot, size);
+  if (size > 1)
+    block[size - 1] = (unsigned char)(slot >> 8);
+}
+
+static int check_block(trace_t* trace, unsigned char* block, size_t slot, size_t size) {
+  if (block[0] == (unsigned char)slot &&
+      (size == 1 || block[size - 1] == (unsigned char)(slot >> 8)))
+    return 0;
+  fprintf(stderr, "%s: block %zu of %zu bytes at %p was overwritten\n", trace->name, slot, size,
+          (void*)block);
+  return -1;
+}
+
+static int check_alignment(trace_t* trace, void* block, size_t slot) {
+  if (block != NULL && (uintptr_t)block % 16 == 0)
+    return 0;
+  fprintf(stderr, "%s: block %zu at %p is %s\n", trace->name, slot, block,
+          block == NULL ? "NULL" : "misaligned");
+  return -1;
+}
+
+/*
+ * Replays TRACE once, checking every block and recording the peak of live
+ * bytes and of heap size in RESULT. Returns -1 if a check failed.
+ */
+static int replay_checked(allocator_t* allocator, trace_t* trace, void** blocks, size_t* sizes,
+                          result_t* result) {
+  size_t base_resident = resident_bytes();
+  size_t live = 0;
+
+  for (size_t i = 0; i < trace->count; i++) {
+    request_t* request = &trace->requests[i];
+    size_t slot = request->slot;
+    size_t size = request->size == 0 ? 1 : request->size;
+
+    switch (request->type) {
+    case 'a':
+      blocks[slot] = allocator->malloc(size);
+      if (check_alignment(trace, blocks[slot], slot) < 0)
+        return -1;
+      tag_block(blocks[slot], slot, size);
+      sizes[slot] = size;
+      live += size;
+      break;
+    case 'r':
+      if (check_block(trace, blocks[slot], slot, sizes[slot]) < 0)
+        return -1;
+      blocks[slot] = allocator->realloc(blocks[slot], size);
+      if (check_alignment(trace, blocks[slot], slot) < 0)
+        return -1;
+      if (((unsigned char*)blocks[slot])[0] != (unsigned char)slot) {
+        fprintf(stderr, "%s: realloc lost the contents of block %zu\n", trace->name, slot);
+        return -1;
+      }
+      tag_block(blocks[slot], slot, size);
+      live = live - sizes[slot] + size;
+      sizes[slot] = size;
+      break;
+    case 'f':
+      if (check_block(trace, blocks[slot], slot, sizes[slot]) < 0)
+        return -1;
+      allocator->free(blocks[slot]);
+      blocks[slot] = NULL;
+      live -= sizes[slot];
+      continue;
+    }
+
+    size_t resident = resident_bytes();
+    size_t heap = resident > base_resident ? resident - base_resident : 0;
+    if (heap > result->peak_heap)
+      result->peak_heap = heap;
+    if (live > result->peak_live)
+      result->peak_live = live;
+  }
+  return 0;
+}
+
+/* Replays TRACE once and returns the seconds it took. */
+static double replay_timed(allocator_t* allocator, trace_t* trace, void** blocks) {
+  double start = now();
+  for (size_t i = 0; i < trace->count; i++) {
+    request_t* request = &trace->requests[i];
+    size_t size = request->size == 0 ? 1 : request->size;
+    switch (request->type) {
+    case 'a':
+      blocks[request->slot] = allocator->malloc(size);
+      break;
+    case 'r':
+      blocks[request->slot] = allocator->realloc(blocks[request->slot], size);
+      break;
+    case 'f':
+      allocator->free(blocks[request->slot]);
+      blocks[request->slot] = NULL;
+      break;
+    }
+  }
+  return now() - start;
+}
+
+/* Frees whatever the trace left allocated. */
+static void free_blocks(allocator_t* allocator, trace_t* trace, void** blocks) {
+  for (size_t slot = 0; slot < trace->slots; slot++) {
+    allocator->free(blocks[slot]);
+    blocks[slot] = NULL;
+  }
+}
+
+static int run(allocator_t* allocator, trace_t* trace, int repeat, result_t* result) {
+  void** blocks = map_memory(trace->slots * sizeof(void*) + 1);
+  size_t* sizes = map_memory(trace->slots * sizeof(size_t) + 1);
+  /* Touch the bookkeeping up front, so it does not count as heap. */
+  memset(blocks, 0, trace->slots * sizeof(void*));
+  memset(sizes, 0, trace->slots * sizeof(size_t));
+
+  memset(result, 0, sizeof(*result));
+  if (replay_checked(allocator, trace, blocks, sizes, result) < 0)
+    return -1;
+  free_blocks(allocator, trace, blocks);
+
+  double best = 0;
+  for (int i = 0; i < repeat; i++) {
+    double elapsed = replay_timed(allocator, trace, blocks);
+    if (i == 0 || elapsed < best)
+      best = elapsed;
+    free_blocks(allocator, trace, blocks);
+  }
+  result->ops_per_second = trace->count / best;
+
+  munmap(sizes, trace->slots * sizeof(size_t) + 1);
+  munmap(blocks, trace->slots * sizeof(void*) + 1);
+  return 0;
+}
+
+/*
+ * Replays TRACE in a child process, so every allocator starts from an empty
+ * heap, and prints a line of results. Returns -1 if the replay failed.
+ */
+static int run_in_child(allocator_t* allocator, const char* library, trace_t* trace, int repeat) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return -1;
+  }
+
+  if (pid == 0) {
+    if (allocator->malloc == NULL)
+      load_mm_functions(allocator, library);
+    result_t result;
+    if (run(allocator, trace, repeat, &result) < 0)
+      _exit(EXIT_FAILURE);
+    printf("%-20s %-12s %10zu %10.0f %12zu %12zu %7.1f%%\n", trace->name, allocator->name,
+           trace->count, result.ops_per_second / 1e3, result.peak_live / 1024,
+           result.peak_heap / 1024,
+           result.peak_heap ? 100.0 * result.peak_live / result.peak_heap : 100.0);
+    fflush(stdout);
+    _exit(EXIT_SUCCESS);
+  }
+
+  int status;
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "%s: replay with %s failed\n", trace->name, allocator->name);
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  const char* library = "hw3lib.so";
+  int repeat = 5;
+  int opt;
+  while ((opt = getopt(argc, argv, "l:r:")) != -1) {
+    if (opt == 'l') {
+      library = optarg;
+    } else if (opt == 'r' && atoi(optarg) > 0) {
+      repeat = atoi(optarg);
+    } else {
+      optind = argc + 1;
+      break;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "Usage: %s [-l LIBRARY] [-r REPEAT] TRACE...\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  /* LIBRARY is loaded by each child, so that it starts with an empty heap. */
+  allocator_t mm = {"mm_malloc", NULL, NULL, NULL};
+  allocator_t libc = {"libc malloc", malloc, realloc, free};
+  allocator_t* allocators[] = {&mm, &libc};
+
+  printf("%-20s %-12s %10s %10s %12s %12s %8s\n", "trace", "allocator", "requests", "Kops/s",
+         "peak live K", "peak heap K", "util");
+  int status = EXIT_SUCCESS;
+  for (int i = optind; i < argc; i++) {
+    trace_t trace;
+    if (load_trace(argv[i], &trace) < 0) {
+      status = EXIT_FAILURE;
+      continue;
+    }
+    for (size_t j = 0; j < sizeof(allocators) / sizeof(allocators[0]); j++) {
+      if (run_in_child(allocators[j], library, &trace, repeat) < 0)
+        status = EXIT_FAILURE;
+    }
+    munmap(trace.requests, trace.capacity * sizeof(request_t));
+  }
+  return status;
+}
@@ -0,0 +1,36 @@
+/*
+ * mm_types.h
+ *
+ * Constants and types of the mm_alloc interface, without its function
+ * declarations, for programs such as mm_test that load the functions with
+ * dlsym under the same names.
+ */
+
+#pragma once
+
+#ifndef _mm_types_H_
+#define _mm_types_H_
+
+#include <stdlib.h>
+
+/* Parameters for mm_mallopt(). */
+#define MM_MMAP_THRESHOLD 1    // Smallest block, in bytes, served by its own mmap.
+#define MM_TRIM_THRESHOLD 2    // Free bytes at the top of the heap, beyond a pad, before trimming.
+#define MM_RELEASE_THRESHOLD 3 // Smallest free block whose pages are given back with madvise.
+#define MM_HUGEPAGES 4         // Nonzero: ask for transparent huge pages for the heaps.
+
+/* Number of size classes reported by mm_stats(). */
+#define MM_STATS_CLASSES 128
+
+typedef struct mm_stats {
+  size_t in_use;         // Bytes in blocks handed out, including ones cached by threads.
+  size_t peak_in_use;    // Largest value in_use has had.
+  size_t mapped;         // Bytes obtained from the OS and not yet given back.
+  size_t free;           // Bytes in free heap blocks.
+  size_t largest_free;   // Size of the largest free heap block.
+  double fragmentation;  // 1 - largest_free / free: how scattered free memory is.
+  size_t mmapped_blocks; // Blocks served by their own mapping.
+  size_t class_blocks[MM_STATS_CLASSES]; // Heap blocks in use, by size class.
+} mm_stats_t;
+
+#endif